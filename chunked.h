@@ -0,0 +1,514 @@
+//
+// Copyright (c) 2000-2003 Brian McNamara and Yannis Smaragdakis
+//
+// Permission to use, copy, modify, distribute and sell this software
+// and its documentation for any purpose is granted without fee,
+// provided that the above copyright notice and this permission notice
+// appear in all source code copies and supporting documentation. The
+// software is provided "as is" without any express or implied
+// warranty.
+
+#ifndef FCPP_CHUNKED_DOT_H
+#define FCPP_CHUNKED_DOT_H
+
+//////////////////////////////////////////////////////////////////////
+// ChunkedList<T> is a lazy list whose nodes each hold a block of up to
+// FCPP_CHUNK_SIZE (default 64) elements, stored contiguously.  A List<T>
+// pays for a node, a thunk, and a virtual call per element; a
+// ChunkedList pays for them once per block, which matters for long
+// lists of small values.  The laziness is per block: looking at one
+// element computes the whole block it is in.
+//
+//    ChunkedList<int> c = toChunked( enumFromTo(1,1000000) );
+//    int s = chunkedFoldl( plus, 0, chunkedMap( inc,
+//                                   chunkedFilter( odd, c ) ) );
+//    List<int> l = fromChunked( chunkedTake( 10, c ) );
+//    for( ChunkedList<int>::iterator i = c.begin(); i != c.end(); ++i )
+//       ...
+//
+// toChunked() and fromChunked() convert from and to List (lazily), and
+// chunkedMap, chunkedFilter, chunkedFoldl, chunkedTake and
+// chunkedZipWith work a block at a time.  Underneath, a ChunkedList is
+// just a List<Chunk<T> >, available from chunks(); a Chunk<T> is an
+// immutable slice of a shared block, so chunkedTake() never copies
+// elements.  chunkedFoldl and chunkedZipWith use the vector kernels in
+// simd.h for plus, multiplies, min and max (and minus, in
+// chunkedZipWith) on ints and doubles.
+//////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include "prelude.h"
+
+#ifndef FCPP_CHUNK_SIZE
+#define FCPP_CHUNK_SIZE 64
+#endif
+
+namespace fcpp {
+
+template <class T> class Chunk;
+template <class T> class ChunkedList;
+
+namespace impl {
+template <class T> class ChunkBuilder;
+
+// A block is filled once (by a ChunkBuilder) and is then only read.
+template <class T>
+class ChunkBlock {
+   std::size_t n;
+   alignas(T) unsigned char space[ sizeof(T) * FCPP_CHUNK_SIZE ];
+
+   ChunkBlock( const ChunkBlock& );
+   void operator=( const ChunkBlock& );
+public:
+   ChunkBlock() : n(0) {}
+   ~ChunkBlock() {
+      for( std::size_t i = 0; i < n; ++i )
+         data()[i].~T();
+   }
+   T* data() { return reinterpret_cast<T*>( space ); }
+   std::size_t size() const { return n; }
+   bool full() const { return n == FCPP_CHUNK_SIZE; }
+   template <class U>
+   void push_back( U&& x ) {
+      new (data()+n) T( std::forward<U>(x) );
+      ++n;
+   }
+   // For the vector kernels, which store ints and doubles straight
+   // into the free space and then say how many they stored
+   T* room() { return data() + n; }
+   void grown( std::size_t k ) { n += k; }
+};
+}
+
+template <class T>
+class Chunk {
+   Ref<impl::ChunkBlock<T> > block;
+   const T* b;
+   const T* e;
+
+   Chunk( const Ref<impl::ChunkBlock<T> >& blk, const T* bb, const T* ee )
+   : block(blk), b(bb), e(ee) {}
+   friend class impl::ChunkBuilder<T>;
+public:
+   typedef T value_type;
+   typedef const T* const_iterator;
+   typedef const_iterator iterator;
+
+   Chunk() : block(), b(0), e(0) {}
+
+   const_iterator begin() const { return b; }
+   const_iterator end() const { return e; }
+   std::size_t size() const { return e - b; }
+   bool empty() const { return b == e; }
+   const T& operator[]( std::size_t i ) const { return b[i]; }
+
+   // Elements [i,j) of this chunk; the result shares the block.
+   Chunk<T> slice( std::size_t i, std::size_t j ) const {
+      return Chunk<T>( block, b+i, b+j );
+   }
+};
+
+namespace impl {
+template <class T>
+class ChunkBuilder {
+   Ref<ChunkBlock<T> > block;
+public:
+   ChunkBuilder() : block( makeRef<ChunkBlock<T> >() ) {}
+   template <class U>
+   void push_back( U&& x ) { block->push_back( std::forward<U>(x) ); }
+   T* room() { return block->room(); }
+   void grown( std::size_t k ) { block->grown( k ); }
+   std::size_t size() const { return block->size(); }
+   bool empty() const { return block->size() == 0; }
+   bool full() const { return block->full(); }
+   Chunk<T> finish() const {
+      const T* d = block->data();
+      return Chunk<T>( block, d, d + block->size() );
+   }
+};
+
+// Takes the first element off l, moving it out of the node when l was
+// the node's only owner.
+template <class T>
+T pop_head( List<T>& l ) {
+   List<T> cur = std::move(l);
+   l = tail(cur);
+   return head( std::move(cur) );
+}
+
+template <class T>
+#ifdef FCPP_NO_STD_ITER
+class ChunkedListIterator : public std::input_iterator<T,std::ptrdiff_t> {
+#else
+class ChunkedListIterator
+: public std::iterator<std::input_iterator_tag,T,std::ptrdiff_t> {
+#endif
+   Chunk<T> cur;
+   const T* p;               // into cur; null at the end
+   List<Chunk<T> > rest;
+   void next_chunk() {
+      if( null(rest) ) {
+         cur = Chunk<T>();
+         p = 0;
+      }
+      else {
+         cur = pop_head( rest );
+         p = cur.begin();
+      }
+   }
+public:
+   ChunkedListIterator() : p(0) {}
+   explicit ChunkedListIterator( const List<Chunk<T> >& cs )
+   : p(0), rest(cs) { next_chunk(); }
+
+   // The iterator keeps its current block alive, so these are good
+   // until it moves on to the next block.
+   const T& operator*() const { return *p; }
+   const T* operator->() const { return p; }
+   ChunkedListIterator<T>& operator++() {
+      if( ++p == cur.end() )
+         next_chunk();
+      return *this;
+   }
+   const ChunkedListIterator<T> operator++(int) {
+      ChunkedListIterator<T> i( *this );
+      ++*this;
+      return i;
+   }
+   bool operator==( const ChunkedListIterator<T>& i ) const {
+      return p == i.p;
+   }
+   bool operator!=( const ChunkedListIterator<T>& i ) const {
+      return p != i.p;
+   }
+};
+}
+
+template <class T>
+class ChunkedList {
+   List<Chunk<T> > cs;    // never holds an empty Chunk
+public:
+   typedef T ElementType;
+
+   ChunkedList() {}
+   ChunkedList( AUniqueTypeForNil ) {}
+   // c must not contain any empty Chunks
+   explicit ChunkedList( const List<Chunk<T> >& c ) : cs(c) {}
+
+   const List<Chunk<T> >& chunks() const { return cs; }
+   operator bool() const { return !null(cs); }
+
+   typedef T value_type;
+   typedef impl::ChunkedListIterator<T> const_iterator;
+   typedef const_iterator iterator;         // ChunkedList is immutable
+   iterator begin() const { return impl::ChunkedListIterator<T>( cs ); }
+   iterator end() const   { return impl::ChunkedListIterator<T>(); }
+};
+
+//////////////////////////////////////////////////////////////////////
+// The producers below are written like XFilterHelp in prelude.h: each
+// one makes a single thunk which reuses itself for every block.
+//////////////////////////////////////////////////////////////////////
+
+namespace impl {
+template <class T>
+struct ToChunkedHelp : public Fun0Impl< OddList<Chunk<T> > > {
+   mutable List<T> l;
+   explicit ToChunkedHelp( const List<T>& ll ) : l(ll) {}
+   OddList<Chunk<T> > operator()() const {
+      if( null(l) )
+         return NIL;
+      ChunkBuilder<T> b;
+      do
+         b.push_back( pop_head(l) );
+      while( !b.full() && !null(l) );
+      return cons( b.finish(), Fun0< OddList<Chunk<T> > >(1,this) );
+   }
+};
+struct XToChunked {
+   template <class L>
+   struct Sig : public FunType<L,ChunkedList<typename L::ElementType> > {};
+
+   template <class L>
+   ChunkedList<typename L::ElementType> operator()( const L& l ) const {
+      typedef typename L::ElementType T;
+      return ChunkedList<T>( Fun0< OddList<Chunk<T> > >(1,
+                new ToChunkedHelp<T>(l) ) );
+   }
+};
+}
+typedef Full1<impl::XToChunked> ToChunked;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ToChunked toChunked;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+template <class T>
+struct FromChunkedHelp : public Fun0Impl< OddList<T> > {
+   mutable ChunkedListIterator<T> i;
+   explicit FromChunkedHelp( const ChunkedList<T>& l ) : i(l.begin()) {}
+   OddList<T> operator()() const {
+      if( i == ChunkedListIterator<T>() )
+         return NIL;
+      return cons( *i++, Fun0< OddList<T> >(1,this) );
+   }
+};
+struct XFromChunked {
+   template <class CL>
+   struct Sig : public FunType<CL,List<typename CL::ElementType> > {};
+
+   template <class T>
+   List<T> operator()( const ChunkedList<T>& l ) const {
+      return Fun0< OddList<T> >(1, new FromChunkedHelp<T>(l) );
+   }
+};
+}
+typedef Full1<impl::XFromChunked> FromChunked;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN FromChunked fromChunked;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+template <class F, class T, class R>
+struct ChunkedMapHelp : public Fun0Impl< OddList<Chunk<R> > > {
+   F f;
+   mutable List<Chunk<T> > cs;
+   ChunkedMapHelp( const F& ff, const List<Chunk<T> >& c ) : f(ff), cs(c) {}
+   OddList<Chunk<R> > operator()() const {
+      if( null(cs) )
+         return NIL;
+      Chunk<T> c = pop_head( cs );
+      ChunkBuilder<R> b;
+      for( const T* p = c.begin(); p != c.end(); ++p )
+         b.push_back( f(*p) );
+      return cons( b.finish(), Fun0< OddList<Chunk<R> > >(1,this) );
+   }
+};
+struct XChunkedMap {
+   template <class F, class CL>
+   struct Sig : public FunType<F,CL,
+      ChunkedList<typename RT<F,typename CL::ElementType>::ResultType> > {};
+
+   template <class F, class T>
+   ChunkedList<typename RT<F,T>::ResultType>
+   operator()( const F& f, const ChunkedList<T>& l ) const {
+      typedef typename RT<F,T>::ResultType R;
+      return ChunkedList<R>( Fun0< OddList<Chunk<R> > >(1,
+                new ChunkedMapHelp<F,T,R>(f,l.chunks()) ) );
+   }
+};
+}
+typedef Full2<impl::XChunkedMap> ChunkedMap;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ChunkedMap chunkedMap;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+// The survivors are packed into full blocks, so a selective filter
+// doesn't leave a trail of nearly-empty chunks behind.
+template <class P, class T>
+struct ChunkedFilterHelp : public Fun0Impl< OddList<Chunk<T> > > {
+   P p;
+   mutable Chunk<T> cur;          // the unexamined part of a block
+   mutable List<Chunk<T> > cs;
+   ChunkedFilterHelp( const P& pp, const List<Chunk<T> >& c )
+   : p(pp), cs(c) {}
+   OddList<Chunk<T> > operator()() const {
+      ChunkBuilder<T> b;
+      while( !b.full() ) {
+         if( cur.empty() ) {
+            if( null(cs) )
+               break;
+            cur = pop_head( cs );
+         }
+         const T* q = cur.begin();
+         for( ; q != cur.end() && !b.full(); ++q )
+            if( p(*q) )
+               b.push_back( *q );
+         cur = cur.slice( q - cur.begin(), cur.size() );
+      }
+      if( b.empty() )
+         return NIL;
+      return cons( b.finish(), Fun0< OddList<Chunk<T> > >(1,this) );
+   }
+};
+struct XChunkedFilter {
+   template <class P, class CL>
+   struct Sig : public FunType<P,CL,CL> {};
+
+   template <class P, class T>
+   ChunkedList<T> operator()( const P& p, const ChunkedList<T>& l ) const {
+      return ChunkedList<T>( Fun0< OddList<Chunk<T> > >(1,
+                new ChunkedFilterHelp<P,T>(p,l.chunks()) ) );
+   }
+};
+}
+typedef Full2<impl::XChunkedFilter> ChunkedFilter;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ChunkedFilter chunkedFilter;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+// Folds a block into e.  With plus, multiplies, min or max on ints or
+// doubles, the block is folded on its own by a vector kernel (see
+// simd.h), and then into e.
+template <class Op, class E, class T, int K = SimdFoldOp<Op,T>::kind>
+struct ChunkFold {
+   static void go( const Op& op, E& e, const Chunk<T>& c ) {
+      for( const T* p = c.begin(); p != c.end(); ++p )
+         e = op( e, *p );
+   }
+};
+template <class Op, class T, int K>
+struct ChunkFold<Op,T,T,K> {
+   static void go( const Op& op, T& e, const Chunk<T>& c ) {
+      e = op( e, simd_reduce<K>( c.begin(), c.size() ) );
+   }
+};
+template <class Op, class T>
+struct ChunkFold<Op,T,T,SIMD_NONE> {
+   static void go( const Op& op, T& e, const Chunk<T>& c ) {
+      for( const T* p = c.begin(); p != c.end(); ++p )
+         e = op( e, *p );
+   }
+};
+
+struct XChunkedFoldl {
+   template <class Op, class E, class CL>
+   struct Sig : public FunType<Op,E,CL,E> {};
+
+   template <class Op, class E, class T>
+   E operator()( const Op& op, E e, const ChunkedList<T>& l ) const {
+      for( List<Chunk<T> > cs = l.chunks(); !null(cs); cs = tail(cs) )
+         ChunkFold<Op,E,T>::go( op, e, head(cs) );
+      return e;
+   }
+};
+}
+typedef Full3<impl::XChunkedFoldl> ChunkedFoldl;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ChunkedFoldl chunkedFoldl;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+template <class T>
+struct ChunkedTakeHelp : public Fun0Impl< OddList<Chunk<T> > > {
+   mutable std::size_t n;
+   mutable List<Chunk<T> > cs;
+   ChunkedTakeHelp( std::size_t nn, const List<Chunk<T> >& c )
+   : n(nn), cs(c) {}
+   OddList<Chunk<T> > operator()() const {
+      if( n == 0 || null(cs) )
+         return NIL;
+      Chunk<T> c = pop_head( cs );
+      if( c.size() > n )
+         c = c.slice( 0, n );
+      n -= c.size();
+      if( n == 0 )
+         cs = NIL;     // let go of the rest of the input
+      return cons( c, Fun0< OddList<Chunk<T> > >(1,this) );
+   }
+};
+struct XChunkedTake {
+   template <class N, class CL>
+   struct Sig : public FunType<N,CL,CL> {};
+
+   template <class T>
+   ChunkedList<T> operator()( std::size_t n, const ChunkedList<T>& l ) const {
+      return ChunkedList<T>( Fun0< OddList<Chunk<T> > >(1,
+                new ChunkedTakeHelp<T>(n,l.chunks()) ) );
+   }
+};
+}
+typedef Full2<impl::XChunkedTake> ChunkedTake;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ChunkedTake chunkedTake;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+// Appends f(a[i],b[i]) for i in [0,k) to out; by a vector kernel (see
+// simd.h) for plus, minus, multiplies, min and max on ints and doubles.
+template <class F, class T, class U, class R, int K = SimdOp<F,T>::kind>
+struct ChunkZip {
+   static void go( const F& f, const T* a, const U* b, std::size_t k,
+                   ChunkBuilder<R>& out ) {
+      for( std::size_t i = 0; i < k; ++i )
+         out.push_back( f( a[i], b[i] ) );
+   }
+};
+template <class F, class T, int K>
+struct ChunkZip<F,T,T,T,K> {
+   static void go( const F&, const T* a, const T* b, std::size_t k,
+                   ChunkBuilder<T>& out ) {
+      simd_zip<K>( a, b, out.room(), k );
+      out.grown( k );
+   }
+};
+template <class F, class T>
+struct ChunkZip<F,T,T,T,SIMD_NONE> {
+   static void go( const F& f, const T* a, const T* b, std::size_t k,
+                   ChunkBuilder<T>& out ) {
+      for( std::size_t i = 0; i < k; ++i )
+         out.push_back( f( a[i], b[i] ) );
+   }
+};
+
+// The two inputs' blocks needn't line up (after a filter, say); each
+// output block is filled from as many input blocks as it takes.
+template <class F, class T, class U, class R>
+struct ChunkedZipWithHelp : public Fun0Impl< OddList<Chunk<R> > > {
+   F f;
+   mutable Chunk<T> a;
+   mutable List<Chunk<T> > as;
+   mutable Chunk<U> b;
+   mutable List<Chunk<U> > bs;
+   ChunkedZipWithHelp( const F& ff, const List<Chunk<T> >& x,
+                       const List<Chunk<U> >& y ) : f(ff), as(x), bs(y) {}
+   OddList<Chunk<R> > operator()() const {
+      ChunkBuilder<R> out;
+      while( !out.full() ) {
+         if( a.empty() ) {
+            if( null(as) )
+               break;
+            a = pop_head( as );
+         }
+         if( b.empty() ) {
+            if( null(bs) )
+               break;
+            b = pop_head( bs );
+         }
+         std::size_t k = FCPP_CHUNK_SIZE - out.size();
+         if( a.size() < k ) k = a.size();
+         if( b.size() < k ) k = b.size();
+         ChunkZip<F,T,U,R>::go( f, a.begin(), b.begin(), k, out );
+         a = a.slice( k, a.size() );
+         b = b.slice( k, b.size() );
+      }
+      if( out.empty() )
+         return NIL;
+      return cons( out.finish(), Fun0< OddList<Chunk<R> > >(1,this) );
+   }
+};
+struct XChunkedZipWith {
+   template <class F, class CL, class CM>
+   struct Sig : public FunType<F,CL,CM,ChunkedList<typename RT<F,
+      typename CL::ElementType,typename CM::ElementType>::ResultType> > {};
+
+   template <class F, class T, class U>
+   ChunkedList<typename RT<F,T,U>::ResultType>
+   operator()( const F& f, const ChunkedList<T>& x,
+               const ChunkedList<U>& y ) const {
+      typedef typename RT<F,T,U>::ResultType R;
+      return ChunkedList<R>( Fun0< OddList<Chunk<R> > >(1,
+         new ChunkedZipWithHelp<F,T,U,R>(f,x.chunks(),y.chunks()) ) );
+   }
+};
+}
+typedef Full3<impl::XChunkedZipWith> ChunkedZipWith;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ChunkedZipWith chunkedZipWith;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+} // end namespace fcpp
+
+#endif
@@ -7,6 +7,10 @@ echo '#define FCPP_MAYBE_DEFINE(x) x'
 echo 'namespace fcpp {'
 for FILE in *.h
 do
+   # these two have their own parallel_definitions.cc
+   if [ "$FILE" == "chunked.h" -o "$FILE" == "parallel.h" ] ; then
+      continue
+   fi
    echo "// from $FILE"
    if [ "$FILE" == "lambda.h" ] ; then
       LAM=
@@ -131,10 +135,12 @@ FCPP_MAYBE_EXTERN Concat concat;
 FCPP_MAYBE_EXTERN Foldr foldr;
 FCPP_MAYBE_EXTERN Foldr1 foldr1;
 FCPP_MAYBE_EXTERN Foldl foldl;
+FCPP_MAYBE_EXTERN FoldlStrict foldlStrict;
 FCPP_MAYBE_EXTERN Foldl1 foldl1;
 FCPP_MAYBE_EXTERN Scanr scanr;
 FCPP_MAYBE_EXTERN Scanr1 scanr1;
 FCPP_MAYBE_EXTERN Scanl scanl;
+FCPP_MAYBE_EXTERN ScanlStrict scanlStrict;
 FCPP_MAYBE_EXTERN Scanl1 scanl1;
 FCPP_MAYBE_EXTERN Iterate iterate;
 FCPP_MAYBE_EXTERN Repeat repeat;
@@ -154,8 +160,15 @@ FCPP_MAYBE_EXTERN And and_;
 FCPP_MAYBE_EXTERN Or or_;
 FCPP_MAYBE_EXTERN All all;
 FCPP_MAYBE_EXTERN Any any;
+FCPP_MAYBE_EXTERN ListIndex listIndex;
 FCPP_MAYBE_EXTERN Elem elem;
 FCPP_MAYBE_EXTERN NotElem notElem;
+FCPP_MAYBE_EXTERN SortBy sortBy;
+FCPP_MAYBE_EXTERN Sort sort;
+FCPP_MAYBE_EXTERN Insert insert;
+FCPP_MAYBE_EXTERN GroupBy groupBy;
+FCPP_MAYBE_EXTERN Group group;
+FCPP_MAYBE_EXTERN Nub nub;
 FCPP_MAYBE_EXTERN Sum sum;
 FCPP_MAYBE_EXTERN Product product;
 FCPP_MAYBE_EXTERN Minimum minimum;
@@ -173,6 +186,7 @@ FCPP_MAYBE_EXTERN EnumFromTo enumFromTo;
 FCPP_MAYBE_EXTERN ListUntil listUntil;
 FCPP_MAYBE_EXTERN AUniqueTypeForNothing NOTHING;
 FCPP_MAYBE_EXTERN Just just;
+FCPP_MAYBE_EXTERN Lookup lookup;
 FCPP_MAYBE_EXTERN Empty empty;
 FCPP_MAYBE_EXTERN HCurry hCurry;
 FCPP_MAYBE_EXTERN HUncurry hUncurry;
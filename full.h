@@ -11,12 +11,56 @@
 #ifndef FCPP_FULL_DOT_H
 #define FCPP_FULL_DOT_H
 
+#include <utility>
 #include "smart.h"
 #include "curry.h"
 #include "pre_lambda.h"
 
 namespace fcpp {
 
+//////////////////////////////////////////////////////////////////////
+// Rvalue arguments
+//////////////////////////////////////////////////////////////////////
+// The FullN wrappers pass rvalue arguments on as rvalues, so that the
+// functoids inside can steal from them (cons() moves an rvalue element
+// into the new list node, for example).  The extra operator()s take
+// "forwarding references" and use the helpers below to make sure they
+// only join in when some argument really is a (non-const) rvalue.
+namespace impl {
+template <bool b, class R> struct EnableIfC { typedef R Type; };
+template <class R> struct EnableIfC<false,R> {};
+
+// Plain<T>::Type is T without any reference or const
+template <class T> struct Plain { typedef T Type; };
+template <class T> struct Plain<T&> : public Plain<T> {};
+template <class T> struct Plain<const T> { typedef T Type; };
+
+template <class T> struct IsRvalue { static const bool value = true; };
+template <class T> struct IsRvalue<T&> { static const bool value = false; };
+template <class T> struct IsRvalue<const T> 
+{ static const bool value = false; };
+
+template <class T> struct IsCurry { static const bool value = false; };
+template <> struct IsCurry<AutoCurryType> 
+{ static const bool value = true; };
+
+// RvalueOnly<T,R>::Type is R if "T&&" was bound to a non-const rvalue
+template <class T, class R> struct RvalueOnly 
+: public EnableIfC<IsRvalue<T>::value,R> {};
+
+template <class X, class Y, class R> struct RvalueOnly2
+: public EnableIfC<(IsRvalue<X>::value || IsRvalue<Y>::value) &&
+                   !IsCurry<typename Plain<X>::Type>::value &&
+                   !IsCurry<typename Plain<Y>::Type>::value, R> {};
+
+template <class X, class Y, class Z, class R> struct RvalueOnly3
+: public EnableIfC<(IsRvalue<X>::value || IsRvalue<Y>::value || 
+                    IsRvalue<Z>::value) &&
+                   !IsCurry<typename Plain<X>::Type>::value &&
+                   !IsCurry<typename Plain<Y>::Type>::value &&
+                   !IsCurry<typename Plain<Z>::Type>::value, R> {};
+}
+
 //////////////////////////////////////////////////////////////////////
 // Full functoids
 //////////////////////////////////////////////////////////////////////
@@ -72,6 +116,12 @@ public:
    inline typename Sig<T>::ResultType operator()( const T& x ) const {
       return f(x);
    }
+   template <class T>
+   inline typename impl::RvalueOnly<T,
+      typename Sig<typename impl::Plain<T>::Type>::ResultType>::Type
+   operator()( T&& x ) const {
+      return f( std::move(x) );
+   }
 };
 
 template <class F>
@@ -115,6 +165,13 @@ public:
 return impl::Curryable2Helper<typename Sig<X,Y>::ResultType,F,X,Y>::go(f,x,y);
    }
 //////////////////////////////////////////////////////////////////////
+   template <class X, class Y>
+   inline typename impl::RvalueOnly2<X,Y,typename Sig<
+      typename impl::Plain<X>::Type,
+      typename impl::Plain<Y>::Type>::ResultType>::Type
+   operator()( X&& x, Y&& y ) const {
+      return f( std::forward<X>(x), std::forward<Y>(y) );
+   }
 };
 
 template <class F>
@@ -188,6 +245,14 @@ return impl::Curryable3Helper2<typename Sig<X,Y>::ResultType,F,X,Y>::go(f,x,y);
       ::go(f,x,y,z);
    }
 //////////////////////////////////////////////////////////////////////
+   template <class X, class Y, class Z>
+   inline typename impl::RvalueOnly3<X,Y,Z,typename Sig<
+      typename impl::Plain<X>::Type,
+      typename impl::Plain<Y>::Type,
+      typename impl::Plain<Z>::Type>::ResultType>::Type
+   operator()( X&& x, Y&& y, Z&& z ) const {
+      return f( std::forward<X>(x), std::forward<Y>(y), std::forward<Z>(z) );
+   }
 };
 
 template <class F> Full0<F> makeFull0( const F& f ) { return Full0<F>(f); }
@@ -20,6 +20,7 @@
 //////////////////////////////////////////////////////////////////////////
 
 #include "ref_count.h"
+#include "pool.h"
 #include "operator.h"
 
 #ifndef FCPP_NO_USE_NAMESPACE
@@ -56,12 +57,15 @@ Fun0Impl<Rd>* convert0( const IRef<const Fun0Impl<Rs> >& f );
 template <class Rd, class DF>
 struct Fun0Constructor;
 
+namespace impl { template <class T> class Cache; }
+
 template <class Result>
 class Fun0 {
    typedef IRef<const Fun0Impl<Result> > RefImpl;
 
    RefImpl ref;
    template <class T> friend class Fun0; 
+   template <class T> friend class impl::Cache;   // see Cache::peek()
    template <class Rd, class Rs>
    friend Fun0<Rd> explicit_convert0( const Fun0<Rs>& f );
 
@@ -87,13 +91,18 @@ public:
    // int is dummy arg to differentiate from the template constructor
    Fun0( int, Impl i ) : ref(i) {}
 
-   Result operator()() const { return ref->operator()(); }
+   Result operator()() const { 
+      FCPP_STAT(fun0_calls);
+      return ref->operator()(); 
+   }
 
    template <class DF>   // direct functoid (or subtype polymorphism)
    Fun0( const DF& f ) : ref( Fun0Constructor<Result,DF>::make(f) ) {}
 
    Fun0( const Fun0& x ) : ref(x.ref) {}
    Fun0& operator=( const Fun0& x ) { ref = x.ref; return *this; }
+   Fun0( Fun0&& x ) : ref(std::move(x.ref)) {}
+   Fun0& operator=( Fun0&& x ) { ref = std::move(x.ref); return *this; }
 #ifdef FCPP_ENABLE_LAMBDA
    typedef Fun0 This;
    template <class A> typename fcpp_lambda::BracketCallable<This,A>::Result
@@ -121,6 +130,16 @@ struct Fun0Impl : public IRefable {
 
    virtual Result operator()() const =0;
    virtual ~Fun0Impl() {}
+   // True for list thunks which can also be read an element at a time
+   // (impl::ListStream in list.h)
+   virtual bool is_stream() const { return false; }
+
+   // Thunks are created and destroyed at a furious rate by lists
+   FCPP_POOL_ALLOCATED
+   Fun0Impl() : IRefable( arena_ref_count(this,&arena_destroy) ) {}
+private:
+   static void arena_destroy( void* p ) 
+   { static_cast<Fun0Impl<Result>*>(p)->~Fun0Impl(); }
 };
 // Since we cheated inheritance above, we need to inform our inheritance
 // detector for the particular case of importance.
@@ -230,6 +249,8 @@ public:
 
    Fun1( const Fun1& x ) : ref(x.ref) {}
    Fun1& operator=( const Fun1& x ) { ref = x.ref; return *this; }
+   Fun1( Fun1&& x ) : ref(std::move(x.ref)) {}
+   Fun1& operator=( Fun1&& x ) { ref = std::move(x.ref); return *this; }
 #ifdef FCPP_ENABLE_LAMBDA
    typedef Fun1 This;
    template <class A> typename fcpp_lambda::BracketCallable<This,A>::Result
@@ -370,6 +391,8 @@ public:
 
    Fun2( const Fun2& x ) : ref(x.ref) {}
    Fun2& operator=( const Fun2& x ) { ref = x.ref; return *this; }
+   Fun2( Fun2&& x ) : ref(std::move(x.ref)) {}
+   Fun2& operator=( Fun2&& x ) { ref = std::move(x.ref); return *this; }
 
    // normal call
    Result operator()( const Arg1& x, const Arg2& y ) const { 
@@ -531,6 +554,8 @@ public:
 
    Fun3Guts( const Fun3Guts& x ) : ref(x.ref) {}
    Fun3Guts& operator=( const Fun3Guts& x ) { ref = x.ref; return *this; }
+   Fun3Guts( Fun3Guts&& x ) : ref(std::move(x.ref)) {}
+   Fun3Guts& operator=( Fun3Guts&& x ) { ref = std::move(x.ref); return *this; }
 };
 
 template <class Arg1, class Arg2, class Arg3, class Result>
@@ -554,6 +579,8 @@ public:
 
    Fun3( const Fun3& x ) : rep(x.rep) {}
    Fun3& operator=( const Fun3& x ) { rep = x.rep; return *this; }
+   Fun3( Fun3&& x ) : rep(std::move(x.rep)) {}
+   Fun3& operator=( Fun3&& x ) { rep = std::move(x.rep); return *this; }
    
    typedef fcpp::Curryable3<Fun3Guts<Arg1,Arg2,Arg3,Result> > SigHelp;
    template <class A, class B=void, class C=void>
@@ -17,6 +17,7 @@
 // Here we implement (lazy) lists in the List class.  There are also a
 // number of functions associated with lists:
 //  - head, tail, cons, cat, null
+//  - buffer_list (a List whose elements are kept in a shared vector)
 ///////////////////////////////////////////////////////////////////////////
 
 // Order-of-initialization debugging help
@@ -29,6 +30,11 @@
 #include <exception>
 #include <new>
 #include <cstdlib>
+#include <iterator>
+#include <vector>
+#ifdef FCPP_THREADSAFE
+#include <thread>
+#endif
 
 #include "reuse.h"
 
@@ -49,11 +55,28 @@ struct CacheDummy {};
 template <class T> struct Cache;
 template <class T> struct OddList;
 template <class T> struct ListIterator;
+template <class T> class ListViewIterator;
+template <class T> class ListView;
+template <class T> class ListBuilder;
 template <class T, class It> struct ListItHelp;
 template <class U,class F> struct cvt;
 template <class T, class F, class R> struct ListHelp;
 template <class T> Cache<T>* xempty_helper();
 template <class T, class F, class R> struct ConsHelp;
+template <class T> struct ListBufferHelp;
+template <class T> struct ListStream;
+template <class T> struct ListBuiltHelp;
+template <class T> class ListSource;
+template <class T> struct ListBufferSpan;
+template <class T> class List;
+template <class T> List<T> buffer_list( std::vector<T> v );
+template <class T> std::size_t known_length( const List<T>& l );
+template <class T> std::size_t known_length( const OddList<T>& l );
+template <class H, class T> 
+bool peek_thunk( const List<T>& l, typename H::Peek& p );
+
+// What known_length() says when it can't tell without walking the list
+const std::size_t UNKNOWN_LENGTH = std::size_t(-1);
 
 struct ListRaw {};
 
@@ -65,6 +88,14 @@ class List {
    template <class U> friend class OddList;
    template <class U, class F, class R> friend struct ConsHelp;
    template <class U,class F> friend struct cvt;
+   template <class U> friend class ListSource;
+   template <class U> friend class ListView;
+   template <class U> friend class ListViewIterator;
+   template <class U> friend class ListBuilder;
+   template <class U> friend std::size_t known_length( const List<U>& );
+   template <class U> friend std::size_t known_length( const OddList<U>& );
+   template <class H, class U> 
+   friend bool peek_thunk( const List<U>&, typename H::Peek& );
 
    List( const IRef<Cache<T> >& p ) : rep(p) {}
    List( ListRaw, Cache<T>* p ) : rep(p) {}
@@ -103,39 +134,33 @@ public:
    // of the entire list before the iterators go away.
    template <class It>
    List( const It& begin, const It& end )
-   : rep( new Cache<T>( ListItHelp<T,It>(begin,end) ) ) {}
+   : rep( new Cache<T>( Fun0<OddList<T> >(1, 
+                          new ListItHelp<T,It>(begin,end)) ) ) {}
 
-   // force evaluation per comment above (assume l is a temporary)
+   // The elements are copied (into a buffer_list()), so l may go away
    List( std::initializer_list<T> &&l )
-     : List( l.begin(), l.end() ) {for(auto e : *this) e;}
+     : List( buffer_list( std::vector<T>( l ) ) ) {}
 
    List( const OddList<T>& e )
    : rep( (e.second.rep != Cache<T>::XNIL()) ? 
           new Cache<T>(e) : Cache<T>::XEMPTY() ) {}
+   List( OddList<T>&& e )
+   : rep( (e.second.rep != Cache<T>::XNIL()) ? 
+          new Cache<T>(std::move(e)) : Cache<T>::XEMPTY() ) {}
 
-#ifdef FCPP_SAFE_LIST
-   // Long lists create long recursions of destructors that blow the
-   // stack.  So we have an iterative destructor.  It is quite tricky to
-   // get right.  The danger is that, when "bypassing" a node to be
-   // unlinked and destructed, that node's 'next' pointer is, in fact, a
-   // List object, whose destructor will be called.  As a result, as you
-   // bypass a node, you need to see if its refC is down to 1, and if
-   // so, mutate its next pointer so that when its destructor is called,
-   // it won't cause a recursive cascade.  
-   ~List() {
-      while( rep != Cache<T>::XNIL() && rep != Cache<T>::XBAD() ) {
-         if( rep->refC == 1 ) {
-            // This is a rotate(), but this sequence is actually faster
-            // than rotate(), so we do it explicitly
-            IRef<Cache<T> > tmp( rep );
-            rep = rep->val.second.rep;
-            tmp->val.second.rep = Cache<T>::XNIL();
-         }
-         else
-            rep = rep->val.second.rep;
+   // A List that has been moved from is empty.
+   List( const List<T>& x ) : rep(x.rep) {}
+   List( List<T>&& x ) : rep( Cache<T>::XEMPTY() ) { 
+      IRef<Cache<T> >::swap( rep, x.rep ); 
+   }
+   List<T>& operator=( const List<T>& x ) { rep = x.rep; return *this; }
+   List<T>& operator=( List<T>&& x ) {
+      if( this != &x ) {
+         rep = std::move(x.rep);
+         x.rep = Cache<T>::XEMPTY();
       }
+      return *this;
    }
-#endif
 
    List<T>& operator= ( std::initializer_list<T> &&l ) 
    {
@@ -145,17 +170,45 @@ public:
      return *this;
    }
    operator bool() const { return !priv_isEmpty(); }
-   const OddList<T>& force() const { return rep->cache(); }
+   const OddList<T>& force() const & { return rep->cache(); }
    const List<T>& delay() const { return *this; }
    // Note: force returns a reference; implicit conversion now returns a copy.
-   operator OddList<T>() const { return force(); }
+   operator OddList<T>() const & { return force(); }
+
+   // An rvalue List which is the only reference to its first node may
+   // steal from that node rather than copying out of it.
+   OddList<T> force() && { 
+      OddList<T>& v = rep->cache();
+      if( ref_count_is_unique(rep->refC) )
+         return std::move(v);
+      return v;
+   }
+   operator OddList<T>() && { return std::move(*this).force(); }
 
    // VC++7.1 says line below makes "return l;" (when l is a List and
    // function returns an OddList) illegal, and I think it's right.
    //operator const OddList<T>&() const { return force(); }
 
-   T head() const { return priv_head(); }
-   List<T> tail() const { return priv_tail(); }
+   T head() const & { return priv_head(); }
+   List<T> tail() const & { return priv_tail(); }
+   T head() && {
+      if( !ref_count_is_unique(rep->refC) ) 
+         return priv_head();
+#ifdef FCPP_DEBUG
+      if( priv_isEmpty() )
+         throw fcpp_exception("Tried to take head() of empty List");
+#endif
+      return std::move( rep->cache().first() );
+   }
+   List<T> tail() && {
+      if( !ref_count_is_unique(rep->refC) ) 
+         return priv_tail();
+#ifdef FCPP_DEBUG
+      if( priv_isEmpty() )
+         throw fcpp_exception("Tried to take tail() of empty List");
+#endif
+      return std::move( rep->cache().second );
+   }
 
    // The following helps makes List almost an STL "container"
    typedef T value_type;
@@ -168,26 +221,14 @@ public:
 struct OddListDummyX {};
 struct OddListDummyY {};
 
-namespace misc_types {
-   struct Argh { virtual int f() {return 0;} };
-   typedef int (*PtrToFxn)();
-   typedef int (Argh::*PtrToMember);
-   typedef int (Argh::*PtrToMemberFxn)();
-}
-
 template <class T> 
 class OddList {
-   // We need to make sure that "fst" is properly aligned to hold a "T"
-   // object, so we do the 'standard' hack.
+   // "fst" is raw storage for a "T".  While an OddList is XBAD (inside
+   // an unforced Cache) it holds no T, and the Cache keeps its thunk in
+   // the same space instead (see Cache::fxn()).
    union {
-      unsigned char fst[ sizeof(T) ];   // The real variable
-      // a bunch of dummies of every conceivable type
-      long z1, *pz1; long double z2, *pz2; void *z3, **pz3; 
-      misc_types::PtrToFxn z4, *pz4;
-      misc_types::Argh *pz5;
-      int z6, *pz6; char z7, *pz7; double z8, *pz8; 
-      misc_types::PtrToMember z9, *pz9;
-      misc_types::PtrToMemberFxn z10, *pz10;
+      alignas(T) unsigned char fst[ sizeof(T) ];   // The real variable
+      void* thunk_space;
    };
 
    const T& first() const { 
@@ -200,6 +241,9 @@ class OddList {
 
    template <class U> friend class List;
    template <class U> friend class Cache;
+   template <class U> friend class ListViewIterator;
+   template <class U> friend class ListBuilder;
+   template <class U> friend std::size_t known_length( const OddList<U>& );
 
    OddList( OddListDummyX ) : second( Cache<T>::XNIL() ) { }
 
@@ -209,6 +253,9 @@ class OddList {
    void init( const T& x ) {
       new (static_cast<void*>(&fst)) T(x);
    } 
+   void init( T&& x ) {
+      new (static_cast<void*>(&fst)) T(std::move(x));
+   } 
 
    bool fst_is_valid() const {
       if( second.rep != Cache<T>::XNIL() )
@@ -241,6 +288,12 @@ public:
    OddList( const T& x, const List<T>& y ) : second(y) { init(x); }
    OddList( const T& x, AUniqueTypeForNil ) 
    : second(Cache<T>::XEMPTY()) { init(x); }
+   OddList( T&& x, const List<T>& y ) : second(y) { init(std::move(x)); }
+   OddList( const T& x, List<T>&& y ) : second(std::move(y)) { init(x); }
+   OddList( T&& x, List<T>&& y ) 
+   : second(std::move(y)) { init(std::move(x)); }
+   OddList( T&& x, AUniqueTypeForNil ) 
+   : second(Cache<T>::XEMPTY()) { init(std::move(x)); }
 
    OddList( const OddList<T>& x ) : second(x.second) {
       if( fst_is_valid() ) {
@@ -248,6 +301,15 @@ public:
       }
    }
 
+   // An OddList that has been moved from is NIL.
+   OddList( OddList<T>&& x ) : second( Cache<T>::XNIL() ) {
+      IRef<Cache<T> >::swap( second.rep, x.second.rep );
+      if( fst_is_valid() ) {
+         init( std::move(x.first()) );
+         x.first().~T();
+      }
+   }
+
    OddList<T>& operator=( const OddList<T>& x ) {
       if( this == &x ) return *this;  
       if( fst_is_valid() ) {
@@ -263,6 +325,25 @@ public:
       second = x.second;
       return *this;
    }
+
+   OddList<T>& operator=( OddList<T>&& x ) {
+      if( this == &x ) return *this;  
+      if( fst_is_valid() ) {
+         if( x.fst_is_valid() )
+            first() = std::move(x.first());
+         else
+            first().~T();
+      }
+      else {
+         if( x.fst_is_valid() )
+            init( std::move(x.first()) );
+      }
+      if( x.fst_is_valid() )
+         x.first().~T();
+      IRef<Cache<T> >::swap( second.rep, x.second.rep );
+      x.second.rep = Cache<T>::XNIL();
+      return *this;
+   }
       
    ~OddList() {
       if( fst_is_valid() ) {
@@ -271,11 +352,27 @@ public:
    }
 
    operator bool() const { return !priv_isEmpty(); }
-   const OddList<T>& force() const { return *this; }
-   List<T> delay() const { return List<T>(*this); }
-
-   T head() const { return priv_head(); }
-   List<T> tail() const { return priv_tail(); }
+   const OddList<T>& force() const & { return *this; }
+   OddList<T> force() && { return std::move(*this); }
+   List<T> delay() const & { return List<T>(*this); }
+   List<T> delay() && { return List<T>(std::move(*this)); }
+
+   T head() const & { return priv_head(); }
+   List<T> tail() const & { return priv_tail(); }
+   T head() && { 
+#ifdef FCPP_DEBUG
+      if( priv_isEmpty() )
+         throw fcpp_exception("Tried to take head() of empty OddList");
+#endif
+      return std::move( first() ); 
+   }
+   List<T> tail() && { 
+#ifdef FCPP_DEBUG
+      if( priv_isEmpty() )
+         throw fcpp_exception("Tried to take tail() of empty OddList");
+#endif
+      return std::move( second ); 
+   }
 };
 
 // This converts ()->List<T> to ()->OddList<T>.
@@ -286,13 +383,12 @@ struct cvt : public CFunType<OddList<U> > {
    F f;
    cvt( const F& ff ) : f(ff) {}
    OddList<U> operator()() const {
-      List<U> l = f();
-      return l.force();
+      return List<U>( f() ).force();
    }
 };
 
-// I malloc a RefCountType to hold the refCount and init it to 1 to ensure the
-// refCount will never get to 0, so the destructor-of-global-object
+// I malloc a RefCountType to hold the refCount and make it immortal to
+// ensure the refCount will never get to 0, so the destructor-of-global-object
 // order at the end of the program is a non-issue.  In other words, the
 // memory allocated here is only reclaimed by the operating system.
 template <class T> 
@@ -302,7 +398,7 @@ Cache<T>* xnil_helper() {
    std::cout << "making a nil/bad:" << typeid(T).name() 
              << " at address " << p << std::endl;
 #endif
-   *((RefCountType*)p) = 1;
+   ref_count_immortal( *new (p) RefCountType(0) );
    return static_cast<Cache<T>*>( p );
 }
 
@@ -311,36 +407,58 @@ Cache<T>* xempty_helper() {
 #ifdef FCPP_1_3_LIST_IMPL
    (void) Cache<T>::xnil;   // Make sure xnil exists before moving forward
 #endif
-   return new Cache<T>( CacheEmpty() );
+   ListArena::Suspend s;   // the sentinel must outlive any arena
+   Cache<T>* p = new Cache<T>( CacheEmpty() );
+   ref_count_immortal( p->refC );
+   return p;
 }
 
+#ifdef FCPP_THREADSAFE
+// States of a Cache under FCPP_THREADSAFE; see Cache::cache_once()
+enum { CACHE_UNFORCED, CACHE_FORCING, CACHE_FORCED };
+#endif
+
 template <class T> 
 class Cache {
    RefCountType refC;
-   mutable Fun0<OddList<T> >   fxn;
+#ifdef FCPP_THREADSAFE
+   mutable std::atomic<unsigned char> state;   // fits in refC's padding
+#endif
    mutable OddList<T>          val;
    // val.second.rep can be XBAD, XNIL, or a valid ptr
-   //  - XBAD: val is invalid (fxn is valid)
+   //  - XBAD: val is invalid (fxn() is valid)
    //  - XNIL: this is the empty list
    //  - anything else: val.first() is head, val.second is tail()
+   // Under FCPP_THREADSAFE, 'state' says which of these may be read:
+   // val is only looked at once state is CACHE_FORCED.
+   //
+   // The thunk is only needed until the node is forced, and the head is
+   // only there after that, so the thunk is kept in val's (otherwise
+   // unused) storage for the head.  A node is then no bigger than its
+   // OddList plus the count.
+   typedef Fun0<OddList<T> > Thunk;
+   Thunk& fxn() const {
+      return *static_cast<Thunk*>( static_cast<void*>( &val.thunk_space ) );
+   }
+   void init_fxn( const Thunk& f ) {
+      new (static_cast<void*>( &val.thunk_space )) Thunk( f );
+   }
 
    // Caches are not copyable or assignable
    Cache( const Cache<T>& );
    void operator=( Cache<T> );
 
-   // This functoid should never be called; it represents a
-   // self-referent Cache, which should be impossible under the current
-   // implementation.  Nonetheless, we need a 'dummy' function object to
-   // represent invalid 'fxn's (val.second.rep!=XBAD), and this
-   // implementation seems to be among the most reasonable.
-   struct blackhole_helper : CFunType< OddList<T> > {
-      OddList<T> operator()() const {
-         throw fcpp_exception("You have entered a black hole.");
-      }
-   };
 #ifdef FCPP_1_3_LIST_IMPL
    static IRef<Cache<T> > xnil, xbad;
    static IRef<Cache<T> > xempty;
+   // The compiler may initialize these in either order; if xempty was
+   // made first, it gets its tail here, once xnil exists.
+   static Cache<T>* make_xnil() {
+      Cache<T>* p = xnil_helper<T>();
+      if( xempty && !xempty->val.second.rep )
+         xempty->val.second.rep = IRef<Cache<T> >( p );
+      return p;
+   }
 #endif
 
    // Don't get rid of these XFOO() functions; they impose no overhead,
@@ -385,21 +503,74 @@ class Cache {
 #endif
       return xbad;
    }
-   static Fun0<OddList<T> > the_blackhole;
-   static Fun0<OddList<T> >& blackhole() {
-#ifndef FCPP_1_3_LIST_IMPL
-      static Fun0<OddList<T> > the_blackhole( makeFun0( blackhole_helper() ) );
-#endif
-      return the_blackhole;
+   // A node which is not in the current ListArena may be forced while
+   // that arena is in use; its tail must go where the node itself is (the
+   // pool, or an outer arena), or it would dangle once the inner arena
+   // is gone.
+   OddList<T> run_fxn() const {
+      FCPP_STAT(cache_forces);
+      if( ListArena* a = ListArena::current() ) {
+         if( !ref_count_is_immortal(refC) ) {
+            ListArena::Suspend s;
+            return fxn()();
+         }
+         if( !a->owns(this) ) {
+            ListArena::Use u( ListArena::owner(this) );
+            return fxn()();
+         }
+      }
+      return fxn()();
+   }
+
+   // Replaces the thunk with its result.  val holds no element yet, so
+   // the result is constructed in place (T need not be assignable).
+   void set_val( OddList<T>&& x ) const {
+      fxn().~Thunk();
+      val.~OddList<T>();
+      new (&val) OddList<T>( std::move(x) );
    }
 
+#ifndef FCPP_THREADSAFE
    OddList<T>& cache() const {
-      if( val.second.rep == XBAD() ) {
-         val = fxn();
-         fxn = blackhole();
-      }
+      if( val.second.rep == XBAD() )
+         set_val( run_fxn() );
       return val;
    }
+#else
+   OddList<T>& cache() const {
+      if( state.load( std::memory_order_acquire ) != CACHE_FORCED )
+         cache_once();
+      return val;
+   }
+   // Many threads may force the same node (e.g. several workers reading
+   // one memoized stream).  The first one to arrive claims the node and
+   // runs fxn; the others yield until the result is published.  If fxn
+   // throws, the node is released so that the next forcer tries again.
+   void cache_once() const {
+      bool waited = false;
+      for(;;) {
+         unsigned char s = CACHE_UNFORCED;
+         if( state.compare_exchange_weak( s, CACHE_FORCING,
+                std::memory_order_acquire, std::memory_order_acquire ) ) {
+            try {
+               set_val( run_fxn() );
+            }
+            catch(...) {
+               state.store( CACHE_UNFORCED, std::memory_order_release );
+               throw;
+            }
+            state.store( CACHE_FORCED, std::memory_order_release );
+            return;
+         }
+         if( s == CACHE_FORCED )
+            return;
+         if( s == CACHE_FORCING ) {
+            if( !waited ) { FCPP_STAT(blackhole_hits); waited = true; }
+            std::this_thread::yield();
+         }
+      }
+   }
+#endif
 
    template <class U> friend class List;
    template <class U> friend class OddList;
@@ -407,35 +578,159 @@ class Cache {
    template <class U,class F> friend struct cvt;
    template <class U, class F, class R> friend struct ListHelp;
    template <class U> friend Cache<U>* xempty_helper();
+   template <class U> friend class ListSource;
+   template <class U> friend class ListViewIterator;
+   template <class U> friend class ListBuilder;
+   template <class U> friend std::size_t known_length( const List<U>& );
+   template <class U> friend std::size_t known_length( const OddList<U>& );
+   template <class H, class U> 
+   friend bool peek_thunk( const List<U>&, typename H::Peek& );
+
+   // This node's thunk, if the caller may read it as a ListStream
+   // instead of forcing the node: the node is unforced, its thunk is a
+   // stream, and the caller holds the only reference to the node (so
+   // nobody else can tell that the node is never forced).
+   const ListStream<T>* stream() const {
+      if( !ref_count_is_unique(refC) )
+         return 0;
+#ifdef FCPP_THREADSAFE
+      if( state.load( std::memory_order_relaxed ) != CACHE_UNFORCED )
+#else
+      if( val.second.rep != XBAD() )
+#endif
+         return 0;
+      const Fun0Impl<OddList<T> >* f = &*fxn().ref;
+      return f->is_stream() ? static_cast<const ListStream<T>*>( f ) : 0;
+   }
+
+   // True if this node is unforced, in which case the caller may look
+   // at its thunk until it calls unclaim().  Under FCPP_THREADSAFE the
+   // node is claimed as if it were being forced, so that nobody runs or
+   // destroys the thunk meanwhile.
+   bool claim() const {
+#ifdef FCPP_THREADSAFE
+      unsigned char st = CACHE_UNFORCED;
+      return state.load( std::memory_order_relaxed ) == CACHE_UNFORCED &&
+             state.compare_exchange_strong( st, CACHE_FORCING,
+                                            std::memory_order_acquire );
+#else
+      return val.second.rep == XBAD();
+#endif
+   }
+   void unclaim() const {
+#ifdef FCPP_THREADSAFE
+      state.store( CACHE_UNFORCED, std::memory_order_release );
+#endif
+   }
+   // Calls unclaim() on the way out, however that happens (the thunk
+   // looked at may run user code which throws)
+   class Claimed {
+      const Cache* c;
+   public:
+      explicit Claimed( const Cache* cc ) : c(cc) {}
+      ~Claimed() { c->unclaim(); }
+   };
 
-   Cache( CacheEmpty ) : refC(0), fxn(blackhole()), val() {}
-   Cache( const OddList<T>& x ) : refC(0), fxn(blackhole()), val(x) {}
-   Cache( const T& x, const List<T>& l ) : refC(0),fxn(blackhole()),val(x,l) {}
-   Cache( CacheDummy ) : refC(0), fxn(blackhole()), val( OddListDummyX() ) {}
+   // If this node is unforced and its thunk is an H, has the thunk
+   // describe what is left of it in p (see peek_thunk())
+   template <class H>
+   bool peek( typename H::Peek& p ) const {
+      if( !claim() )
+         return false;
+      Claimed c( this );
+      const H* h = dynamic_cast<const H*>( &*fxn().ref );
+      if( h )
+         h->peek( p );
+      return h != 0;
+   }
+
+   // The length of the list starting at this node, if that is known
+   // without forcing anything (see known_length()), or UNKNOWN_LENGTH.
+   // A forced node asks its tail (but no further), since that is where
+   // a stream's count is once the first element has been made.
+   std::size_t known_size( bool ask_tail = true ) const {
+      if( claim() ) {
+         Claimed c( this );
+         const Fun0Impl<OddList<T> >* f = &*fxn().ref;
+         return f->is_stream() ? 
+            static_cast<const ListStream<T>*>( f )->size() : UNKNOWN_LENGTH;
+      }
+#ifdef FCPP_THREADSAFE
+      if( state.load( std::memory_order_acquire ) != CACHE_FORCED )
+         return UNKNOWN_LENGTH;
+#endif
+      if( val.second.rep == XNIL() )
+         return 0;
+      if( !ask_tail )
+         return UNKNOWN_LENGTH;
+      std::size_t n = val.second.rep->known_size( false );
+      return n == UNKNOWN_LENGTH ? n : n + 1;
+   }
+
+#ifdef FCPP_THREADSAFE
+#  define FCPP_CACHE_STATE(s) , state(s)
+#else
+#  define FCPP_CACHE_STATE(s)
+#endif
+   static void arena_destroy( void* p ) 
+   { static_cast<Cache<T>*>(p)->~Cache(); }
+   static void release_delete( const void* p ) 
+   { delete static_cast<const Cache<T>*>( p ); }
+   static unsigned int initial_ref_count( Cache<T>* p ) {
+      FCPP_STAT(cache_allocs);
+      return arena_ref_count( p, &arena_destroy );
+   }
+
+   Cache( CacheEmpty ) : refC(initial_ref_count(this)) 
+      FCPP_CACHE_STATE(CACHE_FORCED), val() {}
+   Cache( const OddList<T>& x ) : refC(initial_ref_count(this)) 
+      FCPP_CACHE_STATE(CACHE_FORCED), val(x) {}
+   Cache( OddList<T>&& x ) : refC(initial_ref_count(this)) 
+      FCPP_CACHE_STATE(CACHE_FORCED), val(std::move(x)) {}
+   Cache( const T& x, const List<T>& l ) 
+   : refC(initial_ref_count(this)) 
+      FCPP_CACHE_STATE(CACHE_FORCED), val(x,l) {}
+   Cache( T&& x, const List<T>& l ) 
+   : refC(initial_ref_count(this)) 
+      FCPP_CACHE_STATE(CACHE_FORCED), val(std::move(x),l) {}
+   Cache( CacheDummy ) : refC(initial_ref_count(this)) 
+      FCPP_CACHE_STATE(CACHE_FORCED), val( OddListDummyX() ) {}
 
    Cache( const Fun0<OddList<T> >& f )
-   : refC(0), fxn(f), val( OddListDummyY() ) {}
+   : refC(initial_ref_count(this)) 
+     FCPP_CACHE_STATE(CACHE_UNFORCED), val( OddListDummyY() ) 
+   { init_fxn(f); }
 
    template <class F>
    Cache( const F& f )    // ()->OddList
-   : refC(0), fxn(makeFun0(f)), val( OddListDummyY() ) {}
+   : refC(initial_ref_count(this)) 
+     FCPP_CACHE_STATE(CACHE_UNFORCED), val( OddListDummyY() ) 
+   { init_fxn( makeFun0(f) ); }
 
    // This is for ()->List<T> to ()->OddList<T>
    struct CvtFxn {};
    template <class F>
    Cache( CvtFxn, const F& f )    // ()->List
-   : refC(0), fxn(makeFun0(cvt<T,F>(f))), val( OddListDummyY() ) {}
+   : refC(initial_ref_count(this)) 
+     FCPP_CACHE_STATE(CACHE_UNFORCED), val( OddListDummyY() ) 
+   { init_fxn( makeFun0(cvt<T,F>(f)) ); }
+
+   ~Cache() {
+      if( val.second.rep == XBAD() )
+         fxn().~Thunk();
+   }
+#undef FCPP_CACHE_STATE
 
 public:
-   void incref() { ++refC; }
-   void decref() { if (!--refC) delete this; }
+   FCPP_POOL_ALLOCATED
+
+   void incref() { ref_count_inc(refC); }
+   void decref() 
+   { if (ref_count_dec(refC)) release( this, &release_delete ); }
 };
 
 #ifdef FCPP_1_3_LIST_IMPL
-template <class T>
-Fun0<OddList<T> > Cache<T>::the_blackhole( makeFun0( blackhole_helper() ) );
-
-template <class T> IRef<Cache<T> > Cache<T>::xnil( xnil_helper<T>() );
+template <class T> IRef<Cache<T> > Cache<T>::xnil( Cache<T>::make_xnil() );
 template <class T> IRef<Cache<T> > Cache<T>::xbad( xnil_helper<T>() );
 template <class T> IRef<Cache<T> > Cache<T>::xempty( xempty_helper<T>() );
 #endif
@@ -444,7 +739,7 @@ template <class T> IRef<Cache<T> > Cache<T>::xempty( xempty_helper<T>() );
 
 template <class T, class F> struct ListHelp<T,F,List<T> > {
    IRef<Cache<T> > operator()( const F& f ) const {
-      return IRef<Cache<T> >(new Cache<T>(Cache<T>::CvtFxn(),f));
+      return IRef<Cache<T> >(new Cache<T>(typename Cache<T>::CvtFxn(),f));
    }
 };
 template <class T, class F> struct ListHelp<T,F,OddList<T> > {
@@ -453,13 +748,6 @@ template <class T, class F> struct ListHelp<T,F,OddList<T> > {
    }
 };
 
-template <class T, class It>
-struct ListItHelp : public CFunType<OddList<T> > {
-   It begin, end;
-   ListItHelp( const It& b, const It& e ) : begin(b), end(e) {}
-   OddList<T> operator()() const;
-};
-   
 template <class T>
 #ifdef FCPP_NO_STD_ITER
 class ListIterator : public std::input_iterator<T,std::ptrdiff_t> {
@@ -502,11 +790,124 @@ public:
       return ! this->operator==(i);
    }
 };
+
+// A ListView is a list held still for reading:
+//    for( const Record& r : view( records ) )
+//       ...
+// Its iterators walk the nodes by plain pointer (the view's reference
+// to the first node keeps the rest alive) and hand out references to
+// the elements in the nodes, so a step costs no reference counting and
+// no copying.  Unlike a ListIterator, which lets go of each node as it
+// moves on, a view keeps all of the list it has walked; walk a long
+// generated list (say, enumFrom(1)) with a ListIterator instead.
+template <class T>
+#ifdef FCPP_NO_STD_ITER
+class ListViewIterator : public std::forward_iterator<T,std::ptrdiff_t> {
+#else
+class ListViewIterator : public std::iterator<std::forward_iterator_tag,
+                                 T,std::ptrdiff_t,const T*,const T&> {
+#endif
+   const Cache<T>* p;    // a forced, non-empty node, or null at the end
+   void settle() {
+      if( p->cache().second.rep == Cache<T>::XNIL() )
+         p = 0;
+   }
+public:
+   ListViewIterator() : p(0) {}
+   explicit ListViewIterator( const Cache<T>* c ) : p(c) { settle(); }
+
+   const T& operator*() const { return p->val.first(); }
+   const T* operator->() const { return &p->val.first(); }
+   ListViewIterator<T>& operator++() {
+      p = p->val.second.rep;
+      settle();
+      return *this;
+   }
+   const ListViewIterator<T> operator++(int) {
+      ListViewIterator<T> i( *this );
+      ++*this;
+      return i;
+   }
+   bool operator==( const ListViewIterator<T>& i ) const { return p == i.p; }
+   bool operator!=( const ListViewIterator<T>& i ) const { return p != i.p; }
+};
+
+template <class T>
+class ListView {
+   List<T> l;
+public:
+   typedef T value_type;
+   typedef ListViewIterator<T> const_iterator;
+   typedef const_iterator iterator;
+   explicit ListView( const List<T>& ll ) : l(ll) {}
+   iterator begin() const { return ListViewIterator<T>( l.rep ); }
+   iterator end() const   { return ListViewIterator<T>(); }
+   const List<T>& list() const { return l; }
+};
+
+template <class T>
+ListView<T> view( const List<T>& l ) { return ListView<T>( l ); }
+template <class T>
+ListView<T> view( const OddList<T>& l ) { return ListView<T>( l ); }
+
+// A ListBuilder makes a List front to back, strictly:
+//    ListBuilder<Record> b;
+//    while( parse( in, r ) )
+//       b.push_back( std::move(r) );
+//    List<Record> rs = b.finish();
+// Each element goes straight into an already-forced node, which is
+// hooked onto the end of the list so far, so there is one allocation
+// per element and no reverse() at the end.  Nobody else can see the
+// nodes until finish() hands them over (and empties the builder).
+// The list finish() returns knows its length (see known_length()).
+template <class T>
+class ListBuilder {
+   List<T> l;
+   Cache<T>* last;      // l's last node, or null if l is empty
+   std::size_t n;       // l's length
+
+   ListBuilder( const ListBuilder& );
+   void operator=( const ListBuilder& );
+
+   void append( Cache<T>* c ) {
+      if( last )
+         last->val.second.rep = IRef<Cache<T> >( c );
+      else
+         l.rep = IRef<Cache<T> >( c );
+      last = c;
+      ++n;
+   }
+public:
+   typedef T value_type;    // for std::back_inserter
+   typedef const T& const_reference;
+
+   ListBuilder() : last(0), n(0) {}
+
+   void push_back( const T& x ) { append( new Cache<T>( x, List<T>() ) ); }
+   void push_back( T&& x ) { append( new Cache<T>( std::move(x), List<T>() ) ); }
+   bool empty() const { return last == 0; }
+   std::size_t size() const { return n; }
+
+   // Forced nodes don't keep a list's length, so the nodes are handed
+   // over behind one unforced node which does
+   List<T> finish() {
+      if( !last )
+         return List<T>();
+      std::size_t k = n;
+      last = 0;
+      n = 0;
+      return Fun0< OddList<T> >( 1, new ListBuiltHelp<T>( std::move(l), k ) );
+   }
+};
 }
 
 using impl::List;
 using impl::OddList;
 using impl::ListIterator;
+using impl::ListViewIterator;
+using impl::ListView;
+using impl::view;
+using impl::ListBuilder;
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -524,6 +925,14 @@ struct XHead {
    T operator()( const OddList<T>& l ) const {
       return l.head();
    }
+   template <class T>
+   T operator()( List<T>&& l ) const {
+      return std::move(l).head();
+   }
+   template <class T>
+   T operator()( OddList<T>&& l ) const {
+      return std::move(l).head();
+   }
 };
 }
 typedef Full1<impl::XHead> Head;
@@ -544,6 +953,14 @@ struct XTail {
    List<T> operator()( const OddList<T>& l ) const {
       return l.tail();
    }
+   template <class T>
+   List<T> operator()( List<T>&& l ) const {
+      return std::move(l).tail();
+   }
+   template <class T>
+   List<T> operator()( OddList<T>&& l ) const {
+      return std::move(l).tail();
+   }
 };
 }
 typedef Full1<impl::XTail> Tail;
@@ -575,13 +992,20 @@ namespace impl {
 template <class T, class F> struct ConsHelp<T,F,List<T> > {
    OddList<T> operator()( const T& x, const F& f ) const {
       return OddList<T>(x, List<T>(
-         IRef<Cache<T> >(new Cache<T>(Cache<T>::CvtFxn(),f))));
+         IRef<Cache<T> >(new Cache<T>(typename Cache<T>::CvtFxn(),f))));
+   }
+   OddList<T> operator()( T&& x, const F& f ) const {
+      return OddList<T>(std::move(x), List<T>(
+         IRef<Cache<T> >(new Cache<T>(typename Cache<T>::CvtFxn(),f))));
    }
 };
 template <class T, class F> struct ConsHelp<T,F,OddList<T> > {
    OddList<T> operator()( const T& x, const F& f ) const {
       return OddList<T>(x, List<T>( ListRaw(), new Cache<T>(f) ));
    }
+   OddList<T> operator()( T&& x, const F& f ) const {
+      return OddList<T>(std::move(x), List<T>( ListRaw(), new Cache<T>(f) ));
+   }
 };
 struct XCons {
    template <class T, class L>
@@ -604,6 +1028,44 @@ struct XCons {
    OddList<T> operator()( const T& x, const F& f ) const {
       return ConsHelp<T,F,typename F::ResultType>()(x,f);
    }
+
+   // Rvalue elements (and lists) are moved into the new node.  (The T&&
+   // overloads only match rvalues: either T must also be deduced from
+   // the second argument, or RvalueOnly rules out the lvalue case.)
+   template <class T>
+   OddList<T> operator()( T&& x, const List<T>& l ) const {
+      return OddList<T>(std::move(x),l);
+   }
+   template <class T>
+   OddList<T> operator()( T&& x, List<T>&& l ) const {
+      return OddList<T>(std::move(x),std::move(l));
+   }
+   template <class T>
+   OddList<T> operator()( const T& x, List<T>&& l ) const {
+      return OddList<T>(x,std::move(l));
+   }
+   template <class T>
+   OddList<T> operator()( T&& x, const OddList<T>& l ) const {
+      return OddList<T>(std::move(x),l);
+   }
+   template <class T>
+   OddList<T> operator()( T&& x, OddList<T>&& l ) const {
+      return OddList<T>(std::move(x),List<T>(std::move(l)));
+   }
+   template <class T>
+   OddList<T> operator()( const T& x, OddList<T>&& l ) const {
+      return OddList<T>(x,List<T>(std::move(l)));
+   }
+   template <class T>
+   typename RvalueOnly<T,OddList<T> >::Type
+   operator()( T&& x, const AUniqueTypeForNil& ) const {
+      return OddList<T>(std::move(x),NIL);
+   }
+   template <class T, class F>
+   typename RvalueOnly<T,OddList<T> >::Type
+   operator()( T&& x, const F& f ) const {
+      return ConsHelp<T,F,typename F::ResultType>()(std::move(x),f);
+   }
 };
 }
 typedef Full2<impl::XCons> Cons;
@@ -611,13 +1073,281 @@ FCPP_MAYBE_NAMESPACE_OPEN
 FCPP_MAYBE_EXTERN Cons cons;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
+//////////////////////////////////////////////////////////////////////
+// Stream fusion.  A strict consumer (like foldl) that holds the only
+// reference to an unforced node can't be seen forcing it or not; if the
+// node's thunk is a ListStream, the consumer asks the thunk for the
+// elements one at a time instead, and no nodes are made.  The streams
+// read their own input lists through a ListSource, which does the same
+// thing, so a whole chain like
+//    foldl( plus, 0, map( f, filter( p, enumFromTo(1,n) ) ) )
+// runs as one loop with no intermediate lists.  Nothing changes for
+// lists that are stored or shared: their nodes are made as usual.
+//////////////////////////////////////////////////////////////////////
+
+namespace impl {
+// Room for the one element a ListStream hands over at a time
+template <class T>
+class StreamSlot {
+   union {
+      alignas(T) unsigned char space[ sizeof(T) ];
+   };
+   bool full;
+
+   StreamSlot( const StreamSlot& );
+   void operator=( const StreamSlot& );
+public:
+   StreamSlot() : full(false) {}
+   ~StreamSlot() { clear(); }
+   T& get() { return *static_cast<T*>( static_cast<void*>( space ) ); }
+   template <class U>
+   void put( U&& x ) {
+      clear();
+      new (static_cast<void*>( space )) T( std::forward<U>(x) );
+      full = true;
+   }
+   void clear() {
+      if( full ) {
+         get().~T();
+         full = false;
+      }
+   }
+};
+
+template <class T>
+struct ListStream : public Fun0Impl< OddList<T> > {
+   // Puts the next element in x and returns true, or returns false at
+   // the end.  Once called, the stream belongs to the caller; it is not
+   // used as a thunk any more.
+   virtual bool next( StreamSlot<T>& x ) const =0;
+
+   // How many more times next() will return true, if the stream knows
+   // (a list made from it then has a known_length()).  It is only asked
+   // while nobody is calling next().
+   virtual std::size_t size() const { return UNKNOWN_LENGTH; }
+
+   // As a thunk: the next element, then the rest of the stream (which
+   // is this same object).
+   OddList<T> operator()() const {
+      StreamSlot<T> x;
+      if( !next(x) )
+         return NIL;
+      return cons( std::move(x.get()), Fun0< OddList<T> >(1,this) );
+   }
+   bool is_stream() const { return true; }
+};
+
+// The thunk ListBuilder::finish() puts in front of the nodes it built
+// (l, n of them, all forced and seen by nobody else).  As a thunk it
+// just hands them over; as a stream it moves their elements out.
+template <class T>
+struct ListBuiltHelp : public ListStream<T> {
+   mutable List<T> l;
+   mutable std::size_t n;
+   ListBuiltHelp( List<T>&& ll, std::size_t nn ) : l(std::move(ll)), n(nn) {}
+   bool next( StreamSlot<T>& x ) const {
+      if( n == 0 )
+         return false;
+      List<T> cur = std::move(l);
+      l = tail(cur);
+      x.put( head( std::move(cur) ) );
+      --n;
+      return true;
+   }
+   std::size_t size() const { return n; }
+   OddList<T> operator()() const {
+      n = 0;
+      return std::move(l).force();
+   }
+};
+
+// Reads a list an element at a time, from its stream when it can
+template <class T>
+class ListSource {
+   List<T> l;
+   const ListStream<T>* s;    // l's stream, once we've got it
+   bool shared;               // someone else holds the rest of l
+
+   ListSource( const ListSource& );
+   void operator=( const ListSource& );
+public:
+   explicit ListSource( List<T>&& ll ) : l(std::move(ll)), s(0), 
+      shared(false) {}
+   explicit ListSource( const List<T>& ll ) : l(ll), s(0), shared(false) {}
+
+   bool next( StreamSlot<T>& x ) {
+      if( s )
+         return s->next(x);
+      if( !shared ) {
+         if( (s = l.rep->stream()) != 0 )
+            return s->next(x);
+         // Whatever follows a shared node is shared too
+         shared = !ref_count_is_unique( l.rep->refC );
+      }
+      if( null(l) )
+         return false;
+      if( shared ) {
+         x.put( head(l) );
+         l = tail(l);
+      }
+      else {
+         // Nobody else can see the node, so its head can be moved out
+         // (once forcing it has not thrown)
+         List<T> t = tail(l);
+         List<T> cur = std::move(l);
+         l = std::move(t);
+         x.put( head( std::move(cur) ) );
+      }
+      return true;
+   }
+   // Once the rest of the list is shared, a caller may as well walk it
+   // directly, as rest(), rather than through next()
+   bool is_shared() const { return shared; }
+   List<T> rest() { return s ? List<T>() : std::move(l); }
+   // What next() has left to give, as a list (for a caller that has to
+   // give up part way, e.g. because an element threw).  A stream we were
+   // reading carries on where it left off when the list is forced.
+   List<T> remaining() {
+      s = 0;
+      return std::move(l);
+   }
+   // Lets go of the rest of the list
+   void clear() {
+      s = 0;
+      l = NIL;
+   }
+   // How many elements next() has left to give, or UNKNOWN_LENGTH
+   std::size_t size() const { return s ? s->size() : l.rep->known_size(); }
+};
+
+// The length of l, if l knows it without being walked, or else
+// UNKNOWN_LENGTH.  The lists that know are those still (apart from the
+// first element) in a stream that keeps count: enumFromTo, replicate,
+// take, map, buffer_list, List(begin,end) over random-access iterators,
+// and so on.  Walking such a list uses up the count as it goes, but
+// length() walks only as far as the first node that still knows.
+template <class T>
+std::size_t known_length( const List<T>& l ) {
+   return l.rep->known_size();
+}
+template <class T>
+std::size_t known_length( const OddList<T>& l ) {
+   if( l.priv_isEmpty() )
+      return 0;
+   std::size_t n = l.second.rep->known_size( false );
+   return n == UNKNOWN_LENGTH ? n : n + 1;
+}
+
+// Some thunks can say what is left of their list without being run:
+// an H with a nested type Peek and a member peek(Peek&).  If l's first
+// node is unforced and its thunk is an H, peek_thunk<H>(l,p) fills in
+// p and returns true.  (ListBufferSpan::find() is one of these.)
+template <class H, class T>
+bool peek_thunk( const List<T>& l, typename H::Peek& p ) {
+   return l.rep->template peek<H>( p );
+}
+
+// The thunk for List(begin,end)
 template <class T, class It>
-OddList<T> impl::ListItHelp<T,It>::operator()() const {
-   if( begin == end ) return NIL;
-   It tmp = begin;
-   T x( *begin );
-   return cons( x, ListItHelp<T,It>( ++tmp, end ) );
+struct ListItHelp : public ListStream<T> {
+   mutable It begin;
+   It end;
+   ListItHelp( const It& b, const It& e ) : begin(b), end(e) {}
+   bool next( StreamSlot<T>& x ) const {
+      if( begin == end )
+         return false;
+      x.put( *begin );
+      ++begin;
+      return true;
+   }
+   std::size_t size() const { 
+      return size( typename std::iterator_traits<It>::iterator_category() );
+   }
+   std::size_t size( std::random_access_iterator_tag ) const
+   { return end - begin; }
+   std::size_t size( std::input_iterator_tag ) const
+   { return UNKNOWN_LENGTH; }
+};
+}
+using impl::known_length;
+using impl::UNKNOWN_LENGTH;
+
+//////////////////////////////////////////////////////////////////////
+// buffer_list() makes a List whose elements are held in one shared
+// std::vector rather than in the nodes.  The nodes are only made as the
+// list is walked, and length(), at(), drop() and splitAt() skip over
+// the part of the list that is still in the buffer in O(1):
+//    List<int> l = buffer_list( v );      // v is copied (or moved) in
+//    at( l, 500000 );  length( drop( 10, l ) );
+// Unlike List(begin,end), buffer_list(begin,end) copies the range
+// right away.  ListBufferSpan is the prelude's view of such a list.
+//////////////////////////////////////////////////////////////////////
+
+namespace impl {
+// The thunk for elements [i,j) of buf.  Like the other streams, a node
+// made from it hands it on to its tail, so walking the list makes nodes
+// but no new thunks.
+template <class T>
+struct ListBufferHelp : public ListStream<T> {
+   Ref<const std::vector<T> > buf;
+   mutable std::size_t i;
+   std::size_t j;
+   ListBufferHelp( const Ref<const std::vector<T> >& b, 
+                   std::size_t ii, std::size_t jj ) : buf(b), i(ii), j(jj) {}
+   bool next( StreamSlot<T>& x ) const {
+      if( i == j )
+         return false;
+      x.put( (*buf)[i++] );
+      return true;
+   }
+   std::size_t size() const { return j - i; }
+
+   typedef ListBufferSpan<T> Peek;
+   void peek( Peek& s ) const {
+      s.buf = buf;
+      s.i = i;
+      s.j = j;
+   }
+};
+
+template <class T>
+struct ListBufferSpan {
+   Ref<const std::vector<T> > buf;
+   std::size_t i, j;    // the rest of the list is buf[i..j)
+
+   // If the next node of l is still in a buffer, points this span at
+   // the rest of l and returns true.
+   bool find( const List<T>& l ) 
+   { return peek_thunk< ListBufferHelp<T> >( l, *this ); }
+
+   std::size_t size() const { return j - i; }
+   typename std::vector<T>::const_reference 
+   operator[]( std::size_t k ) const { return (*buf)[i+k]; }
+   // Elements [a,b) of the span, as a List sharing the buffer
+   List<T> slice( std::size_t a, std::size_t b ) const {
+      if( a == b )
+         return List<T>();
+      return Fun0< OddList<T> >(1, new ListBufferHelp<T>( buf, i+a, i+b ) );
+   }
+};
+
+template <class T>
+List<T> buffer_list( std::vector<T> v ) {
+   ListBufferSpan<T> s;
+   s.buf = makeRef<const std::vector<T> >( std::move(v) );
+   s.i = 0;
+   s.j = s.buf->size();
+   return s.slice( 0, s.size() );
+}
+
+template <class It>
+List<typename std::iterator_traits<It>::value_type> 
+buffer_list( It begin, It end ) {
+   typedef typename std::iterator_traits<It>::value_type T;
+   return buffer_list( std::vector<T>( begin, end ) );
+}
 }
+using impl::buffer_list;
 
 namespace impl {
 class XCat {
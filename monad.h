@@ -779,23 +779,19 @@ template <class Monad> struct LiftM3
 
 template <class T>
 struct ByNeedImpl {
-   void incref() const { ++refC_; }
-   void decref() const { if (!--refC_) delete this; }
+   void incref() const { ref_count_inc(refC_); }
+   void decref() const 
+   { if (ref_count_dec(refC_)) release( this, &release_delete ); }
 private:
+   static void release_delete( const void* p ) 
+   { delete static_cast<const ByNeedImpl<T>*>( p ); }
    mutable RefCountType refC_;
-   typedef union {
-      unsigned char val[ sizeof(T) ];   // The real variable
-      // a bunch of dummies of every conceivable type
-      long z1, *pz1; long double z2, *pz2; void *z3, **pz3; 
-      impl::misc_types::PtrToFxn z4, *pz4;
-      impl::misc_types::Argh *pz5;
-      int z6, *pz6; char z7, *pz7; double z8, *pz8; 
-      impl::misc_types::PtrToMember z9, *pz9;
-      impl::misc_types::PtrToMemberFxn z10, *pz10;
-   } U;
-   mutable U u;
-   mutable Fun0<T> fxn;
-   mutable bool val_is_valid;  // FIX THIS: can optimize this away into fxn
+   mutable bool val_is_valid;
+   // Until it is forced, the thunk lives where the value will go
+   mutable union {
+      alignas(T) unsigned char val[ sizeof(T) ];   // The real variable
+      void* thunk_space;
+   } u;
 
    const T& value() const { 
       return *static_cast<const T*>(static_cast<const void*>(&u.val)); 
@@ -803,14 +799,8 @@ private:
    T& value() { 
       return *static_cast<T*>(static_cast<void*>(&u.val));
    }
-   void init( const T& x ) const {
-      new (static_cast<void*>(&u.val)) T(x);
-   }
-
-   static T dummyT() { throw fcpp_exception("Used invalid fxn in ByNeedImpl"); }
-   static Fun0<T> dummy() { 
-      static Fun0<T> f( ptr_to_fun(&ByNeedImpl::dummyT) ); 
-      return f;
+   Fun0<T>& fxn() const { 
+      return *static_cast<Fun0<T>*>(static_cast<void*>(&u.thunk_space));
    }
 
    // No copy/assignment
@@ -818,18 +808,26 @@ private:
    void operator=( const ByNeedImpl& );
 public:
    typedef T ElementType;
-   ByNeedImpl( const T& x ) 
-     : refC_(0), fxn( dummy() ), val_is_valid(true)  { init(x); }
-   ByNeedImpl( Fun0<T> f )  
-     : refC_(0), fxn( f       ), val_is_valid(false) {}
-   const T& force() const {
+   ByNeedImpl( const T& x ) : refC_(0), val_is_valid(true) { 
+      new (static_cast<void*>(&u.val)) T(x);
+   }
+   ByNeedImpl( Fun0<T> f ) : refC_(0), val_is_valid(false) {
+      new (static_cast<void*>(&u.thunk_space)) Fun0<T>(f);
+   }
+   ~ByNeedImpl() {
       if( val_is_valid )
-         return value();
-      else {
-         init( fxn() );
+         value().~T();
+      else
+         fxn().~Fun0<T>();
+   }
+   const T& force() const {
+      if( !val_is_valid ) {
+         T x = fxn()();
+         fxn().~Fun0<T>();
+         new (static_cast<void*>(&u.val)) T( std::move(x) );
          val_is_valid = true;
-         return value();
       }
+      return value();
    }
 };
 
@@ -846,6 +844,10 @@ public:
    }
 };
 
+template <class T>
+struct StrictValue<ByNeed<T> > 
+{ static void force( const ByNeed<T>& b ) { b.force(); } };
+
 namespace impl {
 struct XBForce {
    template <class BT> struct Sig : FunType<BT,typename BT::ElementType> {};
@@ -0,0 +1,921 @@
+//
+// Copyright (c) 2000-2003 Brian McNamara and Yannis Smaragdakis
+//
+// Permission to use, copy, modify, distribute and sell this software
+// and its documentation for any purpose is granted without fee,
+// provided that the above copyright notice and this permission notice
+// appear in all source code copies and supporting documentation. The
+// software is provided "as is" without any express or implied
+// warranty.
+
+#ifndef FCPP_PARALLEL_DOT_H
+#define FCPP_PARALLEL_DOT_H
+
+//////////////////////////////////////////////////////////////////////
+// Parallel strict reductions.  parFoldl, parFoldl1, parSum, parProduct,
+// parMaximum, parMinimum, parAnd, parOr, parAll and parAny compute the
+// same things as foldl, foldl1, sum, ... in prelude.h, but split the
+// work across a pool of threads when the input is a buffer_list (see
+// list.h) that has not been walked yet, or a ChunkedList (see
+// chunked.h).  Any other list is reduced serially, just as the
+// prelude.h function would.
+//
+//    List<int> l = buffer_list( v );
+//    long s = parFoldl( assoc(plus), 0L, l );
+//    int m = parMaximum( toChunked( l ) );
+//    bool b = parAll( even, l );
+//
+// parFoldl and parFoldl1 only split the work if their operator is
+// marked associative with assoc(); with any other operator they run
+// serially, just as foldl does (so parFoldl's result type may differ
+// from the element type).  Each piece of the input is folded starting
+// from its own first element, and the results are combined in order,
+// so the operator need not be commutative, but it must also combine
+// two results: op(e,x) for an element x, and op(e,r) for a result r.
+//
+// The work is done by par_threads() threads: the calling thread and
+// the pool's workers.  par_threads() is hardware_concurrency() unless
+// set_par_threads() says otherwise.  Inputs are cut into pieces of
+// FCPP_PAR_GRAIN (default 16384) elements; an input with fewer than
+// two pieces is reduced on the calling thread.
+//
+// pmap(f,l) is map(f,l), except that f is applied to the elements
+// ahead of the one being looked at, on the pool's workers:
+//
+//    List<Image> thumbs = pmap( makeThumbnail, files );
+//    List<Image> some = pmapAhead( 4, makeThumbnail, files );
+//
+// The result is an ordinary (lazy) List, in the same order as l.
+// pmapAhead(n,f,l) keeps at most n elements in the works at a time;
+// pmap uses twice par_threads().  l itself is only walked on the
+// thread walking the result, and only as far as the look-ahead needs.
+// If f throws, the exception comes out when its element is forced.
+//
+// prefetch(n,l) is l, but with a thread of its own walking up to n
+// elements ahead of the reader, so that a slow producer (a list over
+// an input stream, an iterate() with a costly step) runs alongside
+// whatever consumes it:
+//
+//    List<Record> rs = prefetch( 64, readRecords( file ) );
+//
+// The thread is stopped (after the element it is working on) when the
+// result is dropped (so never, under FCPP_LEAK).  Walking a list on
+// another thread makes and frees its nodes there, so prefetch() needs
+// FCPP_THREADSAFE; without it, prefetch(n,l) just returns l.
+//
+// The functoids given to all of these run on several threads at once,
+// and the workers copy elements and results; if any of these make,
+// copy or drop Lists (or anything else reference counted), build with
+// FCPP_THREADSAFE.  Programs that use this header must be built with
+// threads (-pthread).  Under FCPP_DEFER_DEFINITIONS, the functoids here
+// and in chunked.h are defined in parallel_definitions.cc, which is
+// kept out of definitions.cc so that other programs needn't be.
+//////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "chunked.h"
+
+#ifndef FCPP_PAR_GRAIN
+#define FCPP_PAR_GRAIN 16384
+#endif
+
+namespace fcpp {
+
+namespace impl {
+// What ThreadPool::run() keeps track of.  Helpers which only get
+// going after the job is done still look at it, so it is shared.
+struct ParJob {
+   std::atomic<std::size_t> next, done;
+   std::size_t n;
+   std::mutex m;
+   std::condition_variable cv;
+   std::exception_ptr err;
+   explicit ParJob( std::size_t nn ) : next(0), done(0), n(nn) {}
+};
+
+// Does tasks of j until there are none left to start
+template <class F>
+void par_work( ParJob& j, const F* f ) {
+   std::size_t i;
+   while( (i = j.next++) < j.n ) {
+      try {
+         (*f)( i );
+      }
+      catch( ... ) {
+         std::lock_guard<std::mutex> lock( j.m );
+         if( !j.err )
+            j.err = std::current_exception();
+      }
+      if( ++j.done == j.n ) {
+         std::lock_guard<std::mutex> lock( j.m );
+         j.cv.notify_all();
+      }
+   }
+}
+
+class ThreadPool {
+   std::mutex m;
+   std::condition_variable cv;
+   std::deque<std::function<void()> > q;
+   std::vector<std::thread> workers;
+   bool stopping;
+
+   ThreadPool( const ThreadPool& );
+   void operator=( const ThreadPool& );
+
+   void work() {
+      for(;;) {
+         std::function<void()> t;
+         {
+            std::unique_lock<std::mutex> lock( m );
+            while( !stopping && q.empty() )
+               cv.wait( lock );
+            if( q.empty() )
+               return;
+            t = std::move( q.front() );
+            q.pop_front();
+         }
+         t();
+      }
+   }
+   void start( unsigned n ) {
+      stopping = false;
+      for( unsigned i = 0; i < n; ++i )
+         workers.push_back( std::thread( &ThreadPool::work, this ) );
+   }
+   // Lets the workers finish what is queued, then joins them
+   void stop() {
+      {
+         std::lock_guard<std::mutex> lock( m );
+         stopping = true;
+      }
+      cv.notify_all();
+      for( std::size_t i = 0; i < workers.size(); ++i )
+         workers[i].join();
+      workers.clear();
+   }
+public:
+   explicit ThreadPool( unsigned n ) : stopping(false) { start( n ); }
+   ~ThreadPool() { stop(); }
+
+   unsigned size() const { return workers.size(); }
+   void resize( unsigned n ) { stop(); start( n ); }
+
+   // Runs t on a worker, some time (or right now, if there are none)
+   void submit( std::function<void()> t ) {
+      if( workers.empty() ) {
+         t();
+         return;
+      }
+      {
+         std::lock_guard<std::mutex> lock( m );
+         q.push_back( std::move(t) );
+      }
+      cv.notify_one();
+   }
+
+   // Runs f(0), ..., f(n-1) on the workers and the calling thread, and
+   // returns when they are all done.  If any of them throw, one of the
+   // exceptions is rethrown here.
+   template <class F>
+   void run( std::size_t n, const F& f ) {
+      if( n == 1 || workers.empty() ) {
+         for( std::size_t i = 0; i < n; ++i )
+            f( i );
+         return;
+      }
+      std::shared_ptr<ParJob> j = std::make_shared<ParJob>( n );
+      const F* pf = &f;
+      std::size_t helpers = std::min<std::size_t>( n-1, workers.size() );
+      for( std::size_t i = 0; i < helpers; ++i )
+         submit( [j,pf]() { par_work( *j, pf ); } );
+      par_work( *j, pf );
+      std::unique_lock<std::mutex> lock( j->m );
+      while( j->done < n )
+         j->cv.wait( lock );
+      if( j->err )
+         std::rethrow_exception( j->err );
+   }
+};
+
+inline unsigned& par_threads_setting() {
+   static unsigned n = std::max( 1u, std::thread::hardware_concurrency() );
+   return n;
+}
+inline ThreadPool& thread_pool() {
+   static ThreadPool p( par_threads_setting() - 1 );
+   return p;
+}
+}
+
+inline unsigned par_threads() { return impl::par_threads_setting(); }
+// Not to be called while any parallel work is going on
+inline void set_par_threads( unsigned n ) {
+   if( n == 0 )
+      n = 1;
+   impl::par_threads_setting() = n;
+   impl::thread_pool().resize( n-1 );
+}
+
+//////////////////////////////////////////////////////////////////////
+// assoc(op) is op, marked as associative
+//////////////////////////////////////////////////////////////////////
+
+namespace impl {
+template <class Op>
+struct AssocOp {
+   Op op;
+   explicit AssocOp( const Op& o ) : op(o) {}
+
+   template <class X, class Y>
+   struct Sig : public Op::template Sig<X,Y> {};
+
+   template <class X, class Y>
+   typename Sig<X,Y>::ResultType
+   operator()( const X& x, const Y& y ) const { return op( x, y ); }
+};
+
+template <class Op> struct IsAssoc : public std::false_type {};
+template <class Op>
+struct IsAssoc<Full2<AssocOp<Op> > > : public std::true_type {};
+
+struct XAssoc {
+   template <class Op>
+   struct Sig : public FunType<Op,Full2<AssocOp<Op> > > {};
+
+   template <class Op>
+   Full2<AssocOp<Op> > operator()( const Op& op ) const {
+      return makeFull2( AssocOp<Op>( op ) );
+   }
+};
+}
+typedef Full1<impl::XAssoc> Assoc;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN Assoc assoc;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+// The kinds of input: Lists (and OddLists) and ChunkedLists
+template <class L>
+struct ParList { typedef List<typename L::ElementType> Type; };
+template <class T>
+struct ParList<ChunkedList<T> > { typedef ChunkedList<T> Type; };
+
+// Where a buffer's elements are, if they are stored contiguously
+template <class T>
+const T* par_data( const std::vector<T>& v ) { return v.data(); }
+inline const bool* par_data( const std::vector<bool>& ) { return 0; }
+
+// An input whose elements can be read in place, as runs of contiguous
+// elements, cut up into pieces of about FCPP_PAR_GRAIN elements
+template <class T>
+class ParInput {
+   typedef std::pair<const T*,const T*> Run;
+   std::vector<Run> runs;
+   std::vector<std::size_t> pieces;  // piece k is runs[pieces[k]..pieces[k+1])
+   Ref<const std::vector<T> > buf;   // what keeps the runs alive
+   List<Chunk<T> > chunks;           //   "
+
+   ParInput( const ParInput& );
+   void operator=( const ParInput& );
+
+   void add( const T* b, const T* e ) {
+      for( ; e-b > FCPP_PAR_GRAIN; b += FCPP_PAR_GRAIN )
+         runs.push_back( Run( b, b+FCPP_PAR_GRAIN ) );
+      if( b != e )
+         runs.push_back( Run( b, e ) );
+   }
+   void split() {
+      std::size_t n = 0;
+      pieces.push_back( 0 );
+      for( std::size_t i = 0; i < runs.size(); ++i ) {
+         n += runs[i].second - runs[i].first;
+         if( n >= FCPP_PAR_GRAIN || i+1 == runs.size() ) {
+            pieces.push_back( i+1 );
+            n = 0;
+         }
+      }
+   }
+public:
+   ParInput() {}
+
+   // These return false when l can't be read in place
+   bool find( const List<T>& l ) {
+      ListBufferSpan<T> s;
+      if( !s.find( l ) )
+         return false;
+      const T* d = par_data( *s.buf );
+      if( !d )
+         return false;
+      buf = s.buf;
+      add( d + s.i, d + s.j );
+      split();
+      return true;
+   }
+   bool find( const ChunkedList<T>& l ) {
+      chunks = l.chunks();
+      for( List<Chunk<T> > cs = chunks; !null(cs); cs = tail(cs) ) {
+         const Chunk<T>& c = head(cs);
+         add( c.begin(), c.end() );
+      }
+      split();
+      return true;
+   }
+
+   bool empty() const { return runs.empty(); }
+   std::size_t num_pieces() const { return pieces.size() - 1; }
+   const Run* piece_begin( std::size_t k ) const {
+      return &runs[0] + pieces[k];
+   }
+   const Run* piece_end( std::size_t k ) const {
+      return &runs[0] + pieces[k+1];
+   }
+};
+
+// Folds piece k of a nonempty input, starting from its first element
+template <class E, class Op, class T>
+E par_fold_piece( const Op& op, const ParInput<T>& in, std::size_t k ) {
+   const std::pair<const T*,const T*>* r = in.piece_begin( k );
+   E e( *r->first );
+   for( const T* p = r->first + 1; p != r->second; ++p )
+      e = op( e, *p );
+   for( ++r; r != in.piece_end( k ); ++r )
+      for( const T* p = r->first; p != r->second; ++p )
+         e = op( e, *p );
+   return e;
+}
+
+// Folds a nonempty input, starting from its first element
+template <class E, class Op, class T>
+E par_fold1( const Op& op, const ParInput<T>& in ) {
+   std::size_t n = in.num_pieces();
+   if( n == 1 )
+      return par_fold_piece<E>( op, in, 0 );
+   std::vector<std::unique_ptr<E> > part( n );
+   thread_pool().run( n, [&]( std::size_t k ) {
+      part[k].reset( new E( par_fold_piece<E>( op, in, k ) ) );
+   } );
+   E e( *part[0] );
+   for( std::size_t k = 1; k < n; ++k )
+      e = op( e, *part[k] );
+   return e;
+}
+
+// Whether p(x) == want for some element x; stops looking once found
+template <class P, class T>
+bool par_find( const P& p, bool want, const ParInput<T>& in ) {
+   std::atomic<bool> found( false );
+   auto look = [&]( std::size_t k ) {
+      for( const std::pair<const T*,const T*>* r = in.piece_begin( k );
+           r != in.piece_end( k ); ++r ) {
+         if( found.load( std::memory_order_relaxed ) )
+            return;
+         for( const T* x = r->first; x != r->second; ++x )
+            if( bool( p( *x ) ) == want ) {
+               found = true;
+               return;
+            }
+      }
+   };
+   if( !in.empty() )
+      thread_pool().run( in.num_pieces(), look );
+   return found;
+}
+
+// The serial versions, for inputs that can't be read in place
+template <class Op, class E, class T>
+E par_serial_foldl( const Op& op, const E& e, List<T>&& l ) {
+   return foldl( op, e, std::move(l) );
+}
+template <class Op, class E, class T>
+E par_serial_foldl( const Op& op, const E& e, ChunkedList<T>&& l ) {
+   return chunkedFoldl( op, e, l );
+}
+template <class Op, class T>
+T par_serial_foldl1( const Op& op, List<T>&& l ) {
+   return foldl1( op, std::move(l) );
+}
+template <class Op, class T>
+T par_serial_foldl1( const Op& op, ChunkedList<T>&& l ) {
+   typename ChunkedList<T>::iterator i = l.begin();
+   T e = *i;
+   for( ++i; i != l.end(); ++i )
+      e = op( e, *i );
+   return e;
+}
+template <class P, class T>
+bool par_serial_find( const P& p, bool want, List<T>&& l ) {
+   return want ? any( p, std::move(l) ) : !all( p, std::move(l) );
+}
+template <class P, class T>
+bool par_serial_find( const P& p, bool want, ChunkedList<T>&& l ) {
+   for( typename ChunkedList<T>::iterator i = l.begin(); i != l.end(); ++i )
+      if( bool( p( *i ) ) == want )
+         return true;
+   return false;
+}
+
+// parFoldl and parFoldl1 pick the parallel code at compile time, as an
+// operator which isn't associative need not combine two results (its
+// E and element types may differ), so par_fold1() may not compile.
+template <class Op, class E, class L>
+E par_foldl( const Op& op, const E& e, L&& l, std::false_type ) {
+   return par_serial_foldl( op, e, std::move(l) );
+}
+template <class Op, class E, class L>
+E par_foldl( const Op& op, const E& e, L&& l, std::true_type ) {
+   ParInput<typename L::ElementType> in;
+   if( !in.find( l ) )
+      return par_serial_foldl( op, e, std::move(l) );
+   if( in.empty() )
+      return e;
+   return op( e, par_fold1<E>( op, in ) );
+}
+template <class Op, class L>
+typename L::ElementType par_foldl1( const Op& op, L&& l, std::false_type ) {
+   return par_serial_foldl1( op, std::move(l) );
+}
+template <class Op, class L>
+typename L::ElementType par_foldl1( const Op& op, L&& l, std::true_type ) {
+   typedef typename L::ElementType T;
+   ParInput<T> in;
+   if( !in.find( l ) || in.empty() )
+      return par_serial_foldl1( op, std::move(l) );
+   return par_fold1<T>( op, in );
+}
+
+struct XParFoldl {
+   template <class Op, class E, class L>
+   struct Sig : public FunType<Op,E,L,E> {};
+
+   template <class Op, class E, class L>
+   E operator()( const Op& op, const E& e, L l ) const {
+      typename ParList<L>::Type ll( std::move(l) );
+      return par_foldl( op, e, std::move(ll), IsAssoc<Op>() );
+   }
+};
+}
+typedef Full3<impl::XParFoldl> ParFoldl;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParFoldl parFoldl;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XParFoldl1 {
+   template <class Op, class L>
+   struct Sig : public FunType<Op,L,typename L::ElementType> {};
+
+   template <class Op, class L>
+   typename L::ElementType operator()( const Op& op, L l ) const {
+      typename ParList<L>::Type ll( std::move(l) );
+      return par_foldl1( op, std::move(ll), IsAssoc<Op>() );
+   }
+};
+}
+typedef Full2<impl::XParFoldl1> ParFoldl1;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParFoldl1 parFoldl1;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XParSum {
+   template <class L>
+   struct Sig : public FunType<L,typename L::ElementType> {};
+
+   template <class L>
+   typename L::ElementType operator()( L l ) const {
+      typedef typename L::ElementType T;
+      return parFoldl( assoc(plus), T(0), std::move(l) );
+   }
+};
+}
+typedef Full1<impl::XParSum> ParSum;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParSum parSum;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XParProduct {
+   template <class L>
+   struct Sig : public FunType<L,typename L::ElementType> {};
+
+   template <class L>
+   typename L::ElementType operator()( L l ) const {
+      typedef typename L::ElementType T;
+      return parFoldl( assoc(multiplies), T(1), std::move(l) );
+   }
+};
+}
+typedef Full1<impl::XParProduct> ParProduct;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParProduct parProduct;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XParMinimum {
+   template <class L>
+   struct Sig : public FunType<L,typename L::ElementType> {};
+
+   template <class L>
+   typename L::ElementType operator()( L l ) const {
+      return parFoldl1( assoc(min), std::move(l) );
+   }
+};
+}
+typedef Full1<impl::XParMinimum> ParMinimum;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParMinimum parMinimum;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XParMaximum {
+   template <class L>
+   struct Sig : public FunType<L,typename L::ElementType> {};
+
+   template <class L>
+   typename L::ElementType operator()( L l ) const {
+      return parFoldl1( assoc(max), std::move(l) );
+   }
+};
+}
+typedef Full1<impl::XParMaximum> ParMaximum;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParMaximum parMaximum;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XParAll {
+   template <class P, class L>
+   struct Sig : public FunType<P,L,bool> {};
+
+   template <class P, class L>
+   bool operator()( const P& p, L l ) const {
+      typename ParList<L>::Type ll( std::move(l) );
+      ParInput<typename L::ElementType> in;
+      if( !in.find( ll ) )
+         return !par_serial_find( p, false, std::move(ll) );
+      return !par_find( p, false, in );
+   }
+};
+}
+typedef Full2<impl::XParAll> ParAll;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParAll parAll;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XParAny {
+   template <class P, class L>
+   struct Sig : public FunType<P,L,bool> {};
+
+   template <class P, class L>
+   bool operator()( const P& p, L l ) const {
+      typename ParList<L>::Type ll( std::move(l) );
+      ParInput<typename L::ElementType> in;
+      if( !in.find( ll ) )
+         return par_serial_find( p, true, std::move(ll) );
+      return par_find( p, true, in );
+   }
+};
+}
+typedef Full2<impl::XParAny> ParAny;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParAny parAny;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XParAnd {
+   template <class L>
+   struct Sig : public FunType<L,bool> {};
+
+   template <class L>
+   bool operator()( L l ) const {
+      return parAll( id, std::move(l) );
+   }
+};
+}
+typedef Full1<impl::XParAnd> ParAnd;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParAnd parAnd;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XParOr {
+   template <class L>
+   struct Sig : public FunType<L,bool> {};
+
+   template <class L>
+   bool operator()( L l ) const {
+      return parAny( id, std::move(l) );
+   }
+};
+}
+typedef Full1<impl::XParOr> ParOr;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ParOr parOr;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+//////////////////////////////////////////////////////////////////////
+// pmap
+//////////////////////////////////////////////////////////////////////
+
+namespace impl {
+// States of a PMapSlot.  A slot is QUEUED once it holds an element and
+// its task has been sent to the pool; whichever of the task and the
+// consumer claims it first computes its result.
+enum { PMAP_FREE, PMAP_QUEUED, PMAP_CLAIMED, PMAP_DONE };
+
+template <class T, class R>
+struct PMapSlot {
+   std::atomic<int> state;
+   StreamSlot<T> in;
+   StreamSlot<R> out;
+   std::exception_ptr err;
+   PMapSlot() : state(PMAP_FREE) {}
+   bool claim() {
+      int q = PMAP_QUEUED;
+      return state.compare_exchange_strong( q, PMAP_CLAIMED );
+   }
+};
+
+// The slots are shared with the tasks in the pool, which may outlive
+// the list.  A task only touches a slot's contents (or f) once it has
+// claimed the slot, and a list that goes away claims the slots nobody
+// has claimed yet.
+template <class T, class R>
+struct PMapState {
+   std::unique_ptr<PMapSlot<T,R>[]> slots;
+   std::mutex m;
+   std::condition_variable cv;
+   int waiting;                     // threads in wait(), under m
+   explicit PMapState( std::size_t n ) 
+   : slots( new PMapSlot<T,R>[n] ), waiting(0) {}
+
+   template <class F>
+   void compute( const F& f, PMapSlot<T,R>& s ) {
+      try {
+         s.out.put( f( s.in.get() ) );
+      }
+      catch( ... ) {
+         s.err = std::current_exception();
+      }
+      bool wake;
+      {
+         std::lock_guard<std::mutex> lock( m );
+         s.state = PMAP_DONE;
+         wake = waiting > 0;
+      }
+      if( wake )
+         cv.notify_all();
+   }
+   void wait( PMapSlot<T,R>& s ) {
+      std::unique_lock<std::mutex> lock( m );
+      ++waiting;
+      while( s.state != PMAP_DONE )
+         cv.wait( lock );
+      --waiting;
+   }
+};
+
+template <class F, class T, class R>
+struct PMapHelp : public ListStream<R> {
+   typedef PMapSlot<T,R> Slot;
+   F f;
+   std::size_t ahead;
+   mutable ListSource<T> l;
+   mutable bool ended;             // l has run out
+   std::shared_ptr<PMapState<T,R> > st;
+   mutable std::size_t first, count;  // the slots in use, in order
+
+   PMapHelp( const F& ff, std::size_t n, List<T>&& ll ) 
+   : f(ff), ahead(n), l(std::move(ll)), ended(false),
+     st( std::make_shared<PMapState<T,R> >( n ) ), first(0), count(0) {}
+   ~PMapHelp() {
+      for( ; count; --count, first = (first+1) % ahead ) {
+         Slot& s = slot( first );
+         if( !s.claim() )
+            st->wait( s );
+         s.in.clear();
+         s.out.clear();
+         s.err = std::exception_ptr();
+      }
+   }
+
+   Slot& slot( std::size_t i ) const { return st->slots[ i % ahead ]; }
+
+   // Starts work on elements until the window is full.  Without any
+   // workers, nothing is started early: the consumer does it all.
+   void fill() const {
+      bool pool = thread_pool().size() > 0;
+      while( !ended && count < (pool ? ahead : 1) ) {
+         Slot& s = slot( first + count );
+         if( !l.next( s.in ) ) {
+            ended = true;
+            break;
+         }
+         s.state = PMAP_QUEUED;
+         ++count;
+         if( pool ) {
+            std::shared_ptr<PMapState<T,R> > p = st;
+            const F* pf = &f;
+            Slot* ps = &s;
+            thread_pool().submit( [p,pf,ps]() {
+               if( ps->claim() )
+                  p->compute( *pf, *ps );
+            } );
+         }
+      }
+   }
+
+   bool next( StreamSlot<R>& x ) const {
+      fill();
+      if( count == 0 )
+         return false;
+      Slot& s = slot( first );
+      if( s.claim() )
+         st->compute( f, s );
+      else
+         st->wait( s );
+      if( s.err )
+         std::rethrow_exception( s.err );   // and again, if forced again
+      x.put( std::move( s.out.get() ) );
+      s.in.clear();
+      s.out.clear();
+      s.state = PMAP_FREE;
+      first = (first+1) % ahead;
+      --count;
+      fill();    // keep the workers busy while the caller uses x
+      return true;
+   }
+};
+
+struct XPMapAhead {
+   template <class N, class F, class L>
+   struct Sig : public FunType<N,F,L,
+      List<typename RT<F,typename L::ElementType>::ResultType> > {};
+
+   template <class F, class L>
+   List<typename RT<F,typename L::ElementType>::ResultType>
+   operator()( std::size_t n, const F& f, L l ) const {
+      typedef typename L::ElementType T;
+      typedef typename RT<F,T>::ResultType R;
+      return Fun0< OddList<R> >( 1, new PMapHelp<F,T,R>( f, n ? n : 1,
+                                        List<T>( std::move(l) ) ) );
+   }
+};
+}
+typedef Full3<impl::XPMapAhead> PMapAhead;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN PMapAhead pmapAhead;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XPMap {
+   template <class F, class L>
+   struct Sig : public FunType<F,L,
+      List<typename RT<F,typename L::ElementType>::ResultType> > {};
+
+   template <class F, class L>
+   List<typename RT<F,typename L::ElementType>::ResultType>
+   operator()( const F& f, L l ) const {
+      return pmapAhead( 2 * par_threads(), f, std::move(l) );
+   }
+};
+}
+typedef Full2<impl::XPMap> PMap;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN PMap pmap;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+//////////////////////////////////////////////////////////////////////
+// prefetch
+//////////////////////////////////////////////////////////////////////
+
+namespace impl {
+#ifdef FCPP_THREADSAFE
+// The reader's end of a ring of n elements, which a thread of its own
+// keeps filled from l.  Slots [first,first+count) belong to the reader
+// and the rest to the thread; only first and count need the lock.
+template <class T>
+struct PrefetchHelp : public ListStream<T> {
+   std::size_t n;
+   std::unique_ptr<StreamSlot<T>[]> ring;
+   mutable std::size_t first, count;
+   mutable bool done, stop;
+   mutable std::exception_ptr err;
+   mutable std::mutex m;
+   mutable std::condition_variable more, room;
+   std::thread t;
+
+   PrefetchHelp( std::size_t nn, List<T>&& l ) 
+   : n(nn), ring( new StreamSlot<T>[nn] ), first(0), count(0), 
+     done(false), stop(false), t( &PrefetchHelp::produce, this, 
+                                  std::make_shared<List<T> >(std::move(l)) ) {}
+   ~PrefetchHelp() {
+      {
+         std::lock_guard<std::mutex> lock( m );
+         stop = true;
+      }
+      room.notify_one();
+      t.join();
+   }
+
+   // The thread: l is handed over in a shared_ptr (rather than moved
+   // into the std::thread) so that it is let go of here, by the thread
+   // that walked it.
+   void produce( std::shared_ptr<List<T> > pl ) {
+      try {
+         ListSource<T> l( std::move(*pl) );
+         pl.reset();
+         for(;;) {
+            std::size_t last;
+            {
+               std::unique_lock<std::mutex> lock( m );
+               while( count == n && !stop )
+                  room.wait( lock );
+               if( stop )
+                  return;
+               last = (first + count) % n;
+            }
+            if( !l.next( ring[last] ) )
+               break;
+            {
+               std::lock_guard<std::mutex> lock( m );
+               ++count;
+            }
+            more.notify_one();
+         }
+      }
+      catch( ... ) {
+         std::lock_guard<std::mutex> lock( m );
+         err = std::current_exception();
+      }
+      {
+         std::lock_guard<std::mutex> lock( m );
+         done = true;
+      }
+      more.notify_one();
+   }
+
+   bool next( StreamSlot<T>& x ) const {
+      std::size_t i;
+      {
+         std::unique_lock<std::mutex> lock( m );
+         while( count == 0 && !done )
+            more.wait( lock );
+         if( count == 0 ) {
+            if( err )
+               std::rethrow_exception( err );   // and again, if forced again
+            return false;
+         }
+         i = first;
+      }
+      x.put( std::move( ring[i].get() ) );
+      ring[i].clear();
+      {
+         std::lock_guard<std::mutex> lock( m );
+         first = (first+1) % n;
+         --count;
+      }
+      room.notify_one();
+      return true;
+   }
+};
+#endif
+
+struct XPrefetch {
+   template <class N, class L>
+   struct Sig : public FunType<N,L,List<typename L::ElementType> > {};
+
+   template <class L>
+   List<typename L::ElementType> operator()( std::size_t n, L l ) const {
+      typedef typename L::ElementType T;
+#ifdef FCPP_THREADSAFE
+      return Fun0< OddList<T> >( 1, new PrefetchHelp<T>( n ? n : 1,
+                                        List<T>( std::move(l) ) ) );
+#else
+      (void) n;
+      return List<T>( std::move(l) );
+#endif
+   }
+};
+}
+typedef Full2<impl::XPrefetch> Prefetch;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN Prefetch prefetch;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+} // end namespace fcpp
+
+#endif
@@ -0,0 +1,47 @@
+#ifdef FCPP_THIS_IS_NEVER_DEFINED
+echo '#include "parallel.h"'
+echo '#undef FCPP_MAYBE_EXTERN'
+echo '#define FCPP_MAYBE_EXTERN  '
+echo '#undef FCPP_MAYBE_DEFINE'
+echo '#define FCPP_MAYBE_DEFINE(x) x'
+echo 'namespace fcpp {'
+for FILE in chunked.h parallel.h
+do
+   echo "// from $FILE"
+   cat $FILE | grep ^FCPP_MAYBE_EXTERN
+   cat $FILE | grep ^FCPP_MAYBE_DEFINE 
+done
+echo '}'
+exit
+#endif
+
+#include "parallel.h"
+#undef FCPP_MAYBE_EXTERN
+#define FCPP_MAYBE_EXTERN  
+#undef FCPP_MAYBE_DEFINE
+#define FCPP_MAYBE_DEFINE(x) x
+namespace fcpp {
+// from chunked.h
+FCPP_MAYBE_EXTERN ToChunked toChunked;
+FCPP_MAYBE_EXTERN FromChunked fromChunked;
+FCPP_MAYBE_EXTERN ChunkedMap chunkedMap;
+FCPP_MAYBE_EXTERN ChunkedFilter chunkedFilter;
+FCPP_MAYBE_EXTERN ChunkedFoldl chunkedFoldl;
+FCPP_MAYBE_EXTERN ChunkedTake chunkedTake;
+FCPP_MAYBE_EXTERN ChunkedZipWith chunkedZipWith;
+// from parallel.h
+FCPP_MAYBE_EXTERN Assoc assoc;
+FCPP_MAYBE_EXTERN ParFoldl parFoldl;
+FCPP_MAYBE_EXTERN ParFoldl1 parFoldl1;
+FCPP_MAYBE_EXTERN ParSum parSum;
+FCPP_MAYBE_EXTERN ParProduct parProduct;
+FCPP_MAYBE_EXTERN ParMinimum parMinimum;
+FCPP_MAYBE_EXTERN ParMaximum parMaximum;
+FCPP_MAYBE_EXTERN ParAll parAll;
+FCPP_MAYBE_EXTERN ParAny parAny;
+FCPP_MAYBE_EXTERN ParAnd parAnd;
+FCPP_MAYBE_EXTERN ParOr parOr;
+FCPP_MAYBE_EXTERN PMapAhead pmapAhead;
+FCPP_MAYBE_EXTERN PMap pmap;
+FCPP_MAYBE_EXTERN Prefetch prefetch;
+}
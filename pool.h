@@ -0,0 +1,512 @@
+//
+// Copyright (c) 2000-2003 Brian McNamara and Yannis Smaragdakis
+//
+// Permission to use, copy, modify, distribute and sell this software
+// and its documentation for any purpose is granted without fee,
+// provided that the above copyright notice and this permission notice
+// appear in all source code copies and supporting documentation. The
+// software is provided "as is" without any express or implied
+// warranty.
+
+#ifndef FCPP_POOL_DOT_H
+#define FCPP_POOL_DOT_H
+
+//////////////////////////////////////////////////////////////////////
+// Lists allocate a Cache and (usually) a Fun0Impl thunk for every
+// element, and free them again just as quickly.  Rather than going to
+// the global operator new each time, those classes get their memory
+// from the small-object pool here.
+//
+// The pool keeps one freelist per "size class" (multiples of
+// POOL_GRANULE bytes, up to POOL_MAX_BYTES); anything bigger goes to
+// ::operator new.  Empty freelists are refilled by carving up a fresh
+// POOL_SLAB_BYTES slab.  Slabs are never returned to the system; like
+// the List sentinels, that memory is only reclaimed by the operating
+// system.
+//
+// Under FCPP_THREADSAFE, each thread has its own freelists (so the
+// common case takes no locks).  A thread which frees a lot more than it
+// allocates (a consumer of another thread's list) hands its surplus to
+// a shared depot, where other threads can pick it up; a thread which
+// exits hands back everything.
+//
+// The flag FCPP_NO_POOL turns the pool off, which is handy when running
+// leak checkers and the like.
+//
+// For short-lived lists there is also ListArena (at the end of this
+// file), which bump-allocates instead and frees everything at once.
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <vector>
+#ifdef FCPP_THREADSAFE
+#include <mutex>
+#endif
+
+#include "ref_count.h"
+
+#ifdef FCPP_THREADSAFE
+#  define FCPP_POOL_THREAD_LOCAL thread_local
+#else
+#  define FCPP_POOL_THREAD_LOCAL
+#endif
+
+namespace fcpp {
+
+const std::size_t POOL_GRANULE    = 16;
+const std::size_t POOL_CLASSES    = 16;
+const std::size_t POOL_MAX_BYTES  = POOL_GRANULE * POOL_CLASSES;
+const std::size_t POOL_SLAB_BYTES = 64 * 1024;
+const std::size_t POOL_HIGH_WATER = 4096;  // blocks per class per thread
+const std::size_t POOL_BATCH      = 1024;  // blocks moved to/from the depot
+const std::size_t ARENA_SPARE_BYTES = 64 * 1024 * 1024;  // per thread
+
+namespace impl {
+
+struct PoolBlock {
+   PoolBlock* next;
+};
+
+// A freelist per size class.  Instances are zero-initialized statics
+// (no constructor or destructor), so they may be used at any time,
+// including during static initialization and destruction.
+struct PoolLists {
+   PoolBlock*  head[ POOL_CLASSES ];
+   std::size_t count[ POOL_CLASSES ];
+};
+
+#ifdef FCPP_THREADSAFE
+// Returns a thread's blocks to the depot when the thread exits.
+struct PoolFlusher {
+   ~PoolFlusher();
+};
+#endif
+
+inline PoolLists& pool_lists() {
+   static FCPP_POOL_THREAD_LOCAL PoolLists lists;
+#ifdef FCPP_THREADSAFE
+   // Every thread that touches its lists (even one which only frees)
+   // hands them back when it exits
+   static thread_local PoolFlusher flusher;
+   (void) flusher;
+#endif
+   return lists;
+}
+
+// Unlinks up to n blocks from the front of list i of 'from' and returns
+// them as a chain (the number taken is left in n).
+inline PoolBlock* pool_take( PoolLists& from, std::size_t i, std::size_t& n ) {
+   PoolBlock* first = from.head[i];
+   if( !first ) { n = 0; return 0; }
+   PoolBlock* last = first;
+   std::size_t k = 1;
+   while( k < n && last->next ) {
+      last = last->next;
+      ++k;
+   }
+   from.head[i] = last->next;
+   from.count[i] -= k;
+   last->next = 0;
+   n = k;
+   return first;
+}
+
+// Links a chain of n blocks onto the front of list i of 'to'.
+inline void pool_give( PoolLists& to, std::size_t i,
+                       PoolBlock* chain, std::size_t n ) {
+   if( !chain ) return;
+   PoolBlock* last = chain;
+   while( last->next )
+      last = last->next;
+   last->next = to.head[i];
+   to.head[i] = chain;
+   to.count[i] += n;
+}
+
+#ifdef FCPP_THREADSAFE
+// The depot is where threads trade blocks.  It is never destroyed, so
+// that threads which exit after main() can still reach it.
+struct PoolDepot {
+   std::mutex m;
+   PoolLists lists;
+   PoolDepot() : lists() {}
+};
+
+inline PoolDepot& pool_depot() {
+   static PoolDepot* d = new PoolDepot();
+   return *d;
+}
+
+inline PoolFlusher::~PoolFlusher() {
+   PoolLists& mine = pool_lists();
+   PoolDepot& d = pool_depot();
+   std::lock_guard<std::mutex> lock( d.m );
+   for( std::size_t i=0; i<POOL_CLASSES; ++i ) {
+      std::size_t n = mine.count[i];
+      pool_give( d.lists, i, pool_take( mine, i, n ), n );
+   }
+}
+#endif
+
+// The slow path of pool_alloc(): list i of this thread is empty.
+inline void pool_refill( PoolLists& mine, std::size_t i ) {
+#ifdef FCPP_THREADSAFE
+   {
+      PoolDepot& d = pool_depot();
+      std::lock_guard<std::mutex> lock( d.m );
+      std::size_t n = POOL_BATCH;
+      PoolBlock* chain = pool_take( d.lists, i, n );
+      if( chain ) {
+         pool_give( mine, i, chain, n );
+         return;
+      }
+   }
+#endif
+   const std::size_t size = (i+1) * POOL_GRANULE;
+   const std::size_t n = POOL_SLAB_BYTES / size;
+   char* slab = static_cast<char*>( ::operator new( POOL_SLAB_BYTES ) );
+   for( std::size_t k=0; k<n; ++k ) {
+      PoolBlock* b = reinterpret_cast<PoolBlock*>( slab + k*size );
+      b->next = mine.head[i];
+      mine.head[i] = b;
+   }
+   mine.count[i] += n;
+}
+
+inline std::size_t pool_class( std::size_t bytes ) {
+   return (bytes + POOL_GRANULE - 1) / POOL_GRANULE - 1;
+}
+
+} // end namespace impl
+
+//////////////////////////////////////////////////////////////////////
+// ListArena
+//////////////////////////////////////////////////////////////////////
+// While a ListArena is alive, every pool-allocated object (List nodes,
+// the element values stored in them, and thunks like the ones Reusers
+// make) created by the same thread is bump-allocated from the arena
+// instead.  These objects are created with an immortal reference count,
+// so no reference counting is done on them at all, and when the arena
+// goes out of scope they are all destroyed in one linear pass (no
+// recursive decref cascade) and their memory is released in bulk.
+//    {
+//       ListArena arena;
+//       List<int> l = map( f, enumFromTo(1,1000000) );
+//       result = foldl( plus, 0, l );
+//    }  // every node and thunk of l is released here
+// Lists which were created outside the arena may be used (and forced)
+// inside it; the nodes forced for them go where the list's own nodes
+// are: to the normal pool, or to the (outer) arena that built it.  But
+// nothing created inside the arena may escape it: a List built in the
+// scope must not be stored anywhere that outlives the ListArena object.
+// Arenas nest; the innermost one is used.
+//////////////////////////////////////////////////////////////////////
+
+class ListArena {
+   // Each allocation is preceded by a header, so that the arena can walk
+   // its objects and destroy them.  'offset' is where the registered
+   // object (e.g. the Fun0Impl part of a thunk) sits in the allocation.
+   struct Header {
+      unsigned int size;     // including the header
+      unsigned int offset;
+      void (*destroy)( void* );
+   };
+   struct Chunk {
+      Chunk* next;
+      char*  top;
+      char*  end;
+   };
+   static const std::size_t ALIGN = 16;
+   static std::size_t round_up( std::size_t n ) 
+   { return (n + ALIGN - 1) / ALIGN * ALIGN; }
+   static const std::size_t HEADER_BYTES = 
+      (sizeof(Header) + ALIGN - 1) / ALIGN * ALIGN;
+   static const std::size_t CHUNK_BYTES = 
+      (sizeof(Chunk) + ALIGN - 1) / ALIGN * ALIGN;
+
+   Chunk*      chunks;      // newest first
+   std::vector<Chunk*> by_addr;   // the same, in address order
+   char*       top;
+   char*       end;
+   Header*     last;
+   std::size_t chunk_bytes;
+   ListArena*  prev;
+
+   static char* data( Chunk* c ) 
+   { return reinterpret_cast<char*>(c) + CHUNK_BYTES; }
+   // The end of what has been handed out from c
+   char* used( Chunk* c ) const { return c == chunks ? top : c->top; }
+
+   // The chunk p is in, if it is memory we have handed out.  The newest
+   // chunk is checked first, as that is almost always where p is; the
+   // rest are searched by address, since pool_free() asks about every
+   // pool block freed while an arena is in use.
+   Chunk* chunk_of( const void* p ) const {
+      const char* q = static_cast<const char*>(p);
+      if( !chunks )
+         return 0;
+      Chunk* c = chunks;
+      if( !( q >= data(c) && q < used(c) ) ) {
+         if( q < reinterpret_cast<const char*>( by_addr.front() ) ||
+             q >= by_addr.back()->end )
+            return 0;
+         std::vector<Chunk*>::const_iterator i = 
+            std::upper_bound( by_addr.begin(), by_addr.end(), q, after );
+         if( i == by_addr.begin() )
+            return 0;
+         c = *--i;
+      }
+      return ( q >= data(c) && q < used(c) ) ? c : 0;
+   }
+   static bool after( const char* q, const Chunk* c ) 
+   { return q < reinterpret_cast<const char*>(c); }
+
+   // The header of the allocation p points into, or 0 if p isn't ours.
+   // Usually that is the latest one; but in "new X( f() )" the
+   // allocation for X comes before f() runs, and f() may allocate too.
+   Header* header_of( const void* p ) const {
+      const char* q = static_cast<const char*>(p);
+      if( last && q >= reinterpret_cast<const char*>(last) + HEADER_BYTES &&
+          q < reinterpret_cast<const char*>(last) + last->size )
+         return last;
+      Chunk* c = chunk_of( p );
+      if( !c )
+         return 0;
+      for( char* h = data(c); ; ) {
+         Header* hh = reinterpret_cast<Header*>(h);
+         h += hh->size;
+         if( q < h )
+            return hh;
+      }
+   }
+   static std::size_t bytes( Chunk* c ) 
+   { return c->end - reinterpret_cast<char*>(c); }
+
+   // The chunks of dead arenas are kept (up to ARENA_SPARE_BYTES) for
+   // the next arena on the thread.  Giving the pages back to malloc (and
+   // the OS) and faulting them in again costs more than the arena saves.
+   struct Spares {
+      Chunk*      head;
+      std::size_t bytes;
+      Spares() : head(0), bytes(0) {}
+      ~Spares() {
+         while( head ) {
+            Chunk* c = head;
+            head = c->next;
+            ::operator delete( c );
+         }
+      }
+   };
+   static Spares& spares() {
+      static FCPP_POOL_THREAD_LOCAL Spares s;
+      return s;
+   }
+
+   void grow( std::size_t need ) {
+      if( chunks ) chunks->top = top;
+      std::size_t want = CHUNK_BYTES + 
+         (need > chunk_bytes ? need : chunk_bytes);
+      Spares& s = spares();
+      Chunk* c = s.head;
+      if( c && bytes(c) >= want ) {
+         s.head = c->next;
+         s.bytes -= bytes(c);
+      }
+      else {
+         c = static_cast<Chunk*>( ::operator new( want ) );
+         c->end = reinterpret_cast<char*>(c) + want;
+      }
+      c->next = chunks;
+      chunks = c;
+      top = data(c);
+      end = c->end;
+      by_addr.insert( std::upper_bound( by_addr.begin(), by_addr.end(),
+                         reinterpret_cast<const char*>(c), after ), c );
+   }
+
+   // No copying
+   ListArena( const ListArena& );
+   void operator=( const ListArena& );
+public:
+   explicit ListArena( std::size_t chunk = POOL_SLAB_BYTES ) 
+   : chunks(0), top(0), end(0), last(0), chunk_bytes(chunk), 
+     prev(current()) {
+      current() = this;
+   }
+
+   ~ListArena() {
+      current() = prev;
+      if( chunks ) chunks->top = top;
+      for( Chunk* c = chunks; c; c = c->next )
+         for( char* p = data(c); p != c->top; ) {
+            Header* h = reinterpret_cast<Header*>(p);
+            if( h->destroy )
+               h->destroy( p + HEADER_BYTES + h->offset );
+            p += h->size;
+         }
+      Spares& s = spares();
+      while( chunks ) {
+         Chunk* c = chunks;
+         chunks = c->next;
+         if( s.bytes + bytes(c) <= ARENA_SPARE_BYTES ) {
+            c->next = s.head;
+            s.head = c;
+            s.bytes += bytes(c);
+         }
+         else
+            ::operator delete( c );
+      }
+   }
+
+   // The arena (if any) in use by this thread
+   static ListArena*& current() {
+      static FCPP_POOL_THREAD_LOCAL ListArena* a;
+      return a;
+   }
+
+   void* allocate( std::size_t bytes ) {
+      std::size_t need = HEADER_BYTES + round_up( bytes );
+      if( std::size_t(end - top) < need )
+         grow( need );
+      last = reinterpret_cast<Header*>(top);
+      last->size = static_cast<unsigned int>( need );
+      last->offset = 0;
+      last->destroy = 0;
+      top += need;
+      return reinterpret_cast<char*>(last) + HEADER_BYTES;
+   }
+
+   // If p is (part of) an object we allocated memory for, arrange for
+   // destroy(p) to be called when the arena dies and return true.
+   bool adopt( const void* p, void (*destroy)( void* ) ) {
+      Header* h = header_of( p );
+      if( !h )
+         return false;
+      h->offset = static_cast<unsigned int>( static_cast<const char*>(p) -
+         reinterpret_cast<const char*>(h) - HEADER_BYTES );
+      h->destroy = destroy;
+      return true;
+   }
+
+   // operator delete on arena memory only happens when a constructor
+   // throws; the object must then not be destroyed again later.
+   bool release( void* p ) {
+      Header* h = header_of( p );
+      if( !h )
+         return false;
+      h->destroy = 0;
+      return true;
+   }
+
+   // Does p point into memory this arena has handed out?
+   bool owns( const void* p ) const { return chunk_of( p ) != 0; }
+
+   // The arena (of those this thread has open) which p lives in, or 0
+   static ListArena* owner( const void* p ) {
+      for( ListArena* a = current(); a; a = a->prev )
+         if( a->owns( p ) )
+            return a;
+      return 0;
+   }
+
+   // Temporarily makes 'a' the arena in use (0 turns arenas off)
+   class Use {
+      ListArena* saved;
+   public:
+      explicit Use( ListArena* a ) : saved( current() ) { current() = a; }
+      ~Use() { current() = saved; }
+   };
+
+   // Temporarily turns off whatever arena is in use
+   class Suspend : public Use {
+   public:
+      Suspend() : Use( 0 ) {}
+   };
+};
+
+// Pool-allocated classes use this to get their initial reference count:
+// objects which live in an arena are immortal.  (adopt() finds any
+// allocation of the arena, so this only says 0 for an object that is
+// not in the arena at all, like one on the stack.)
+template <class T>
+unsigned int arena_ref_count( const T* p, void (*destroy)( void* ) ) {
+   ListArena* a = ListArena::current();
+   if( a && a->adopt( p, destroy ) )
+      return IMMORTAL_REF_COUNT;
+   return 0;
+}
+
+inline void* pool_alloc( std::size_t bytes ) {
+   if( ListArena* a = ListArena::current() )
+      return a->allocate( bytes );
+#ifndef FCPP_NO_POOL
+   if( bytes && bytes <= POOL_MAX_BYTES ) {
+      std::size_t i = impl::pool_class( bytes );
+      impl::PoolLists& mine = impl::pool_lists();
+      if( !mine.head[i] )
+         impl::pool_refill( mine, i );
+      impl::PoolBlock* b = mine.head[i];
+      mine.head[i] = b->next;
+      --mine.count[i];
+      return b;
+   }
+#endif
+   return ::operator new( bytes );
+}
+
+inline void pool_free( void* p, std::size_t bytes ) {
+   if( !p ) return;
+   // Arena memory (of this arena, or of an outer one) must never go on
+   // a freelist: it is gone once its arena is
+   if( ListArena::current() )
+      if( ListArena* a = ListArena::owner( p ) ) {
+         a->release( p );
+         return;
+      }
+#ifndef FCPP_NO_POOL
+   if( bytes && bytes <= POOL_MAX_BYTES ) {
+      std::size_t i = impl::pool_class( bytes );
+      impl::PoolLists& mine = impl::pool_lists();
+      impl::PoolBlock* b = static_cast<impl::PoolBlock*>( p );
+      b->next = mine.head[i];
+      mine.head[i] = b;
+#ifdef FCPP_THREADSAFE
+      if( ++mine.count[i] > POOL_HIGH_WATER ) {
+         impl::PoolDepot& d = impl::pool_depot();
+         std::size_t n = POOL_HIGH_WATER - POOL_BATCH;
+         impl::PoolBlock* chain = impl::pool_take( mine, i, n );
+         std::lock_guard<std::mutex> lock( d.m );
+         impl::pool_give( d.lists, i, chain, n );
+      }
+#else
+      ++mine.count[i];
+#endif
+      return;
+   }
+#else
+   (void) bytes;
+#endif
+   ::operator delete( p );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Classes which want their instances to come from the pool just say
+//    FCPP_POOL_ALLOCATED
+// in their definition.  The sized operator delete gets the size of the
+// dynamic type (as long as the destructor is virtual), so this is safe
+// to put in a polymorphic base class.
+//////////////////////////////////////////////////////////////////////
+
+#define FCPP_POOL_ALLOCATED                                            \
+   static void* operator new( std::size_t n )                          \
+   { return ::fcpp::pool_alloc( n ); }                                 \
+   static void operator delete( void* p, std::size_t n )               \
+   { ::fcpp::pool_free( p, n ); }                                      \
+   static void* operator new( std::size_t, void* p ) { return p; }     \
+   static void operator delete( void*, void* ) {}
+
+} // end namespace fcpp
+
+#endif
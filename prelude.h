@@ -29,7 +29,17 @@
 // optimized counterparts.
 //////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#ifdef FCPP_THREADSAFE
+#include <mutex>
+#endif
 #include "list.h"
+#include "simd.h"
 
 namespace fcpp {
 
@@ -297,20 +307,191 @@ FCPP_MAYBE_NAMESPACE_OPEN
 FCPP_MAYBE_EXTERN Init init;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
+// StrictValue<T>::force(x) makes x do any work it is still putting off,
+// to its outermost layer only (as Haskell's seq does): a List forces its
+// first node, a ByNeed its value, and a std::pair both halves.  Other
+// types are taken to be evaluated already.  Specialize it for your own
+// lazy types; foldlStrict() and scanlStrict() use it.
+template <class T>
+struct StrictValue { static void force( const T& ) {} };
+
+template <class T>
+struct StrictValue<List<T> > 
+{ static void force( const List<T>& l ) { null(l); } };
+
+template <class A, class B>
+struct StrictValue<std::pair<A,B> > {
+   static void force( const std::pair<A,B>& p ) {
+      StrictValue<A>::force( p.first );
+      StrictValue<B>::force( p.second );
+   }
+};
+
+namespace impl {
+// How foldl() and foldlStrict() replace the accumulator e with op(e,x).
+// E need not be assignable.
+struct LazyStep {
+   template <class Op, class E, class X>
+   static void step( const Op& op, E& e, const X& x ) {
+      E tmp( e );
+      e.~E();
+      new (&e) E( op(tmp,x) );
+   }
+};
+struct StrictStep {
+   // op gets e as an rvalue, so it may reuse e's storage
+   template <class Op, class E, class X>
+   static void step( const Op& op, E& e, const X& x ) {
+      E tmp( op( std::move(e), x ) );
+      StrictValue<E>::force( tmp );
+      put( e, tmp, typename std::is_move_assignable<E>::type() );
+   }
+   template <class E>
+   static void put( E& e, E& x, std::true_type ) { e = std::move(x); }
+   template <class E>
+   static void put( E& e, E& x, std::false_type ) {
+      e.~E();
+      new (&e) E( std::move(x) );
+   }
+};
+}
+
+namespace impl {
+// The lists of enumFromTo (and of enumFrom, for integers) are made
+// from one thunk holding the range still to come, x, x+1, ..., y.
+// While nobody has walked an integer range, at(), drop(), foldl() (so
+// sum(), product(), ...) and elem() read it directly: a counted loop or
+// a comparison with the ends, with no nodes made.  Any lazy use makes
+// nodes as usual.  Ranges only ever step by one; there is no general
+// step (no enumFromThenTo).
+template <class T>
+struct EnumRange {
+   T x, y;
+   bool done;    // nothing left (x==y may still have one)
+   EnumRange() : x(), y(), done(true) {}
+   EnumRange( const T& xx, const T& yy ) : x(xx), y(yy), done( yy < xx ) {}
+   bool empty() const { return done || y < x; }
+   // Moves on to the next value, but never past y (which may be the
+   // largest T there is)
+   void pop() {
+      if( x == y )
+         done = true;
+      else
+         ++x;
+   }
+   size_t size() const { 
+      return size( typename std::is_integral<T>::type() ); 
+   }
+   size_t size( std::true_type ) const {
+      if( empty() )
+         return 0;
+      size_t d = size_t(y) - size_t(x);   // right for negatives too
+      if( sizeof(T) > sizeof(size_t) || d+1 == 0 )
+         return UNKNOWN_LENGTH;
+      return d+1;
+   }
+   size_t size( std::false_type ) const { return UNKNOWN_LENGTH; }
+};
+
+template <class T>
+struct XEFTH : public ListStream<T> {
+   mutable EnumRange<T> r;
+   XEFTH( const T& x, const T& y ) : r(x,y) {}
+   bool next( StreamSlot<T>& s ) const {
+      if( r.empty() )
+         return false;
+      s.put( r.x );
+      r.pop();
+      return true;
+   }
+   size_t size() const { return r.size(); }
+
+   typedef EnumRange<T> Peek;
+   void peek( Peek& p ) const { p = r; }
+};
+
+// enumFrom for types with no largest value
+template <class T>
+struct XEFH : public ListStream<T> {
+   mutable T x;
+   XEFH( const T& xx ) : x(xx) {}
+   bool next( StreamSlot<T>& s ) const {
+      s.put( x );
+      ++x;
+      return true;
+   }
+};
+
+// The shortcuts for unwalked integer ranges; each returns false if l
+// isn't one.
+template <class T, bool = std::is_integral<T>::value>
+struct EnumRanges {
+   static bool at( const List<T>&, size_t, StreamSlot<T>& ) { return false; }
+   static bool drop( const List<T>&, size_t, List<T>& ) { return false; }
+   template <class Step, class Op, class E>
+   static bool foldl( const Op&, E&, const List<T>& ) { return false; }
+   static bool elem( const T&, const List<T>&, bool& ) { return false; }
+};
+template <class T>
+struct EnumRanges<T,true> {
+   static bool at( const List<T>& l, size_t n, StreamSlot<T>& x ) {
+      EnumRange<T> r;
+      if( !peek_thunk< XEFTH<T> >( l, r ) || n >= r.size() )
+         return false;
+      x.put( T( r.x + n ) );
+      return true;
+   }
+   static bool drop( const List<T>& l, size_t n, List<T>& d ) {
+      EnumRange<T> r;
+      if( !peek_thunk< XEFTH<T> >( l, r ) )
+         return false;
+      if( n >= r.size() )
+         d = NIL;
+      else
+         d = Fun0<OddList<T> >( 1, new XEFTH<T>( T( r.x + n ), r.y ) );
+      return true;
+   }
+   template <class Step, class Op, class E>
+   static bool foldl( const Op& op, E& e, const List<T>& l ) {
+      EnumRange<T> r;
+      if( !peek_thunk< XEFTH<T> >( l, r ) )
+         return false;
+      if( !r.empty() )
+         for(;;) {
+            Step::step( op, e, r.x );
+            if( r.x == r.y )
+               break;
+            ++r.x;
+         }
+      return true;
+   }
+   static bool elem( const T& x, const List<T>& l, bool& found ) {
+      EnumRange<T> r;
+      if( !peek_thunk< XEFTH<T> >( l, r ) )
+         return false;
+      found = !r.empty() && !(x < r.x) && !(r.y < x);
+      return true;
+   }
+};
+}
+
 namespace impl {
 struct XLength {
    template <class L>
    struct Sig : public FunType<L,size_t> {};
 
+   // Walks only until a node knows the length of the rest of the list
    template <class L>
    size_t operator()( const L& ll ) const {
       List<typename L::ElementType> l = ll;
-      size_t x = 0;
-      while( !null(l) ) {
+      size_t x = 0, n;
+      while( (n = known_length(l)) == UNKNOWN_LENGTH ) {
+         if( null(l) )
+            return x;
          l = tail(l);
          ++x;
       }
-      return x;
+      return x + n;
    }
 };
 }
@@ -327,11 +508,22 @@ struct XAt {
 
    template <class L>
    typename L::ElementType operator()( L l, size_t n ) const {
-      while( n!=0 ) {
-         l = tail(l);
-         --n;
+      List<typename L::ElementType> m = l;
+      size_t k = known_length(m);
+      if( k != UNKNOWN_LENGTH && n >= k )
+         return head( List<typename L::ElementType>() );   // off the end
+      StreamSlot<typename L::ElementType> x;
+      if( EnumRanges<typename L::ElementType>::at( m, n, x ) )
+         return std::move( x.get() );
+      ListBufferSpan<typename L::ElementType> s;
+      for( ; !s.find(m); --n ) {
+         if( n==0 )
+            return head(m);
+         m = tail(m);
       }
-      return head(l);
+      if( n < s.size() )
+         return s[n];
+      return head( List<typename L::ElementType>() );   // off the end
    }
 };
 }
@@ -358,22 +550,15 @@ struct XFilter {
 };
 #else
 template <class P, class T>
-struct XFilterHelp : public Fun0Impl< OddList<T> > {
+struct XFilterHelp : public ListStream<T> {
    P p;
-   mutable List<T> l;
-   XFilterHelp( const P& pp, const List<T>& ll ) : p(pp), l(ll) {}
-   OddList<T> operator()() const {
-      while(1) {
-         if( null(l) )
-            return NIL;
-         else if( p( head(l) ) ) {
-            T x = head(l);
-            l = tail(l);
-            return cons( x, Fun0< OddList<T> >(1,this) );
-         }
-         else
-            l = tail(l);
-      }
+   mutable ListSource<T> l;
+   XFilterHelp( const P& pp, List<T>&& ll ) : p(pp), l(std::move(ll)) {}
+   bool next( StreamSlot<T>& x ) const {
+      while( l.next(x) )
+         if( p( x.get() ) )
+            return true;
+      return false;
    }
 };
 struct XFilter {
@@ -383,8 +568,9 @@ struct XFilter {
    template <class P, class L>
    List<typename L::ElementType>
    operator()( const P& p, L l ) const {
-      return Fun0< OddList<typename L::ElementType> >(1, 
-               new XFilterHelp<P,typename L::ElementType>(p,l) );
+      typedef typename L::ElementType T;
+      return Fun0< OddList<T> >(1, 
+               new XFilterHelp<P,T>( p, List<T>(std::move(l)) ) );
    }
 };
 /* For filter, the version with a Reuser is just not as good as the
@@ -490,20 +676,29 @@ FCPP_MAYBE_EXTERN Foldr1 foldr1;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
 namespace impl {
+// A temporary list is read as a stream (see ListSource in list.h)
+template <class Step, class Op, class E, class L>
+E foldl_with( const Op& op, E e, L ll ) {
+   typedef typename L::ElementType T;
+   List<T> m( std::move(ll) );
+   if( EnumRanges<T>::template foldl<Step>( op, e, m ) )
+      return e;
+   ListSource<T> l( std::move(m) );
+   StreamSlot<T> x;
+   while( !l.is_shared() && l.next(x) )
+      Step::step( op, e, x.get() );
+   for( List<T> r = l.rest(); !null(r); r = tail(r) )
+      Step::step( op, e, head(r) );
+   return e;
+}
+
 struct XFoldl {
    template <class Op, class E, class L>
    struct Sig : public FunType<Op,E,L,E> {};
 
    template <class Op, class E, class L>
-   E operator()( const Op& op, E e, const L& ll ) const {
-      List<typename L::ElementType> l = ll;
-      while( !null(l) ) {
-         E tmp( e );
-         e.~E();
-         new (&e) E( op(tmp,head(l)) );
-         l = tail(l);
-      }
-      return e;
+   E operator()( const Op& op, E e, L l ) const {
+      return foldl_with<LazyStep>( op, std::move(e), std::move(l) );
    }
 };
 }
@@ -512,6 +707,27 @@ FCPP_MAYBE_NAMESPACE_OPEN
 FCPP_MAYBE_EXTERN Foldl foldl;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
+namespace impl {
+// foldl, but each new accumulator is forced (see StrictValue) before the
+// next step, so an accumulator that is itself lazy (a List, a ByNeed)
+// doesn't pile up a chain of unrun thunks.  op is passed the old
+// accumulator as an rvalue.
+struct XFoldlStrict {
+   template <class Op, class E, class L>
+   struct Sig : public FunType<Op,E,L,E> {};
+
+   template <class Op, class E, class L>
+   E operator()( const Op& op, E e, L l ) const {
+      StrictValue<E>::force( e );
+      return foldl_with<StrictStep>( op, std::move(e), std::move(l) );
+   }
+};
+}
+typedef Full3<impl::XFoldlStrict> FoldlStrict;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN FoldlStrict foldlStrict;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
 namespace impl {
 struct XFoldl1 {
    template <class Op, class L>
@@ -607,6 +823,68 @@ FCPP_MAYBE_NAMESPACE_OPEN
 FCPP_MAYBE_EXTERN Scanl scanl;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
+namespace impl {
+// scanl, forcing each accumulator (see StrictValue) as it is made
+#ifdef FCPP_SIMPLE_PRELUDE
+struct XScanlStrict {
+   template <class Op, class E, class L>
+   struct Sig : public FunType<Op,E,L,List<E> > {};
+
+   template <class Op, class E, class T>
+   List<E> operator()( const Op& op, const E& e, const List<T>& l ) const {
+      StrictValue<E>::force( e );
+      if( null(l) )
+         return cons( e, NIL );
+      else
+         return cons( e, curry3( XScanlStrict(), op, op(e,head(l)), tail(l) ));
+   }
+};
+#else
+template <class Op, class E, class T>
+struct XScanlStrictHelp : public ListStream<E> {
+   Op op;
+   mutable E e;
+   mutable bool started;
+   mutable ListSource<T> l;
+   XScanlStrictHelp( const Op& o, E&& ee, List<T>&& ll ) 
+      : op(o), e(std::move(ee)), started(false), l(std::move(ll)) {}
+   bool next( StreamSlot<E>& x ) const {
+      if( started ) {
+         StreamSlot<T> y;
+         if( !l.next(y) )
+            return false;
+         StrictStep::step( op, e, y.get() );
+      }
+      else {
+         StrictValue<E>::force( e );
+         started = true;
+      }
+      x.put( e );
+      return true;
+   }
+   size_t size() const {
+      size_t n = l.size();
+      return ( n == UNKNOWN_LENGTH || started ) ? n : n + 1;
+   }
+};
+struct XScanlStrict {
+   template <class Op, class E, class L>
+   struct Sig : public FunType<Op,E,L,List<E> > {};
+
+   template <class Op, class E, class L>
+   List<E> operator()( const Op& op, E e, L l ) const {
+      typedef typename L::ElementType T;
+      return Fun0< OddList<E> >( 1, new XScanlStrictHelp<Op,E,T>( op, 
+         std::move(e), List<T>(std::move(l)) ) );
+   }
+};
+#endif
+}
+typedef Full3<impl::XScanlStrict> ScanlStrict;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ScanlStrict scanlStrict;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
 namespace impl {
 struct XScanl1 {
    template <class Op, class L>
@@ -699,6 +977,20 @@ struct XMap {
    }
 };
 #else
+template <class F, class T, class R>
+struct XMapHelp : public ListStream<R> {
+   F f;
+   mutable ListSource<T> l;
+   XMapHelp( const F& ff, List<T>&& ll ) : f(ff), l(std::move(ll)) {}
+   bool next( StreamSlot<R>& x ) const {
+      StreamSlot<T> y;
+      if( !l.next(y) )
+         return false;
+      x.put( f( std::move(y.get()) ) );
+      return true;
+   }
+   size_t size() const { return l.size(); }
+};
 struct XMap {
    template <class F, class L>
    struct Sig : public FunType<F,L,
@@ -706,13 +998,11 @@ struct XMap {
 
    template <class F, class L>
    OddList<typename RT<F,typename L::ElementType>::ResultType> 
-   operator()( const F& f, const L& l, 
-               Reuser2<Inv,Inv,Var,XMap,F,List<typename L::ElementType> >
-               r = NIL ) const {
-      if( null(l) )
-         return NIL;
-      else
-         return cons( f(head(l)), r( XMap(), f, tail(l) ) );
+   operator()( const F& f, L l ) const {
+      typedef typename L::ElementType T;
+      typedef typename RT<F,T>::ResultType R;
+      Fun0< OddList<R> > s(1, new XMapHelp<F,T,R>( f, List<T>(std::move(l)) ));
+      return s();
    }
 };
 #endif
@@ -723,6 +1013,18 @@ FCPP_MAYBE_EXTERN Map map;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
 namespace impl {
+// The thunk of a sort() that hasn't run yet.  take(k,sort(l)) tells it
+// (through peek_thunk()) that only k elements are wanted, so it can pick
+// those out in O(n log k) rather than sort everything first.  The rest
+// still gets sorted if somebody walks that far.
+template <class T>
+struct SortStream : public ListStream<T> {
+   virtual void prefix( size_t k ) const =0;
+
+   typedef size_t Peek;
+   void peek( Peek& k ) const { prefix( k ); }
+};
+
 #ifdef FCPP_SIMPLE_PRELUDE
 struct XTake {
    template <class N,class L>
@@ -737,19 +1039,44 @@ struct XTake {
    }
 };
 #else
+template <class T>
+struct XTakeHelp : public ListStream<T> {
+   mutable size_t n;
+   mutable ListSource<T> l;
+   XTakeHelp( size_t nn, List<T>&& ll ) : n(nn), l(std::move(ll)) {}
+   bool next( StreamSlot<T>& x ) const {
+      if( n==0 || !l.next(x) )
+         return false;
+      if( --n==0 )
+         l.clear();   // that was the last one; let go of the input
+      return true;
+   }
+   // An input of unknown length may stop short of n
+   size_t size() const {
+      if( n==0 )
+         return 0;
+      size_t k = l.size();
+      if( k == UNKNOWN_LENGTH )
+         return UNKNOWN_LENGTH;
+      return k < n ? k : n;
+   }
+};
 struct XTake {
    template <class N,class L>
    struct Sig : public FunType<N,L,OddList<typename L::ElementType> > {};
 
    template <class L>
-   OddList<typename L::ElementType> 
-   operator()( size_t n, const L& l,
-               Reuser2<Inv,Var,Var,XTake,size_t,List<typename L::ElementType> > 
-               r = NIL ) const {
-      if( n==0 || null(l) )
+   OddList<typename L::ElementType> operator()( size_t n, L l ) const {
+      typedef typename L::ElementType T;
+      if( n==0 )
          return NIL;
-      else
-         return cons( head(l), r( XTake(), n-1, tail(l) ) );
+      List<T> m( std::move(l) );
+      size_t k = known_length(m);
+      if( k != UNKNOWN_LENGTH && k <= n )
+         return m.force();    // all of it
+      peek_thunk< SortStream<T> >( m, n );
+      Fun0< OddList<T> > s(1, new XTakeHelp<T>( n, std::move(m) ));
+      return s();
    }
 };
 #endif
@@ -767,7 +1094,17 @@ struct XDrop {
    template <class L>
    List<typename L::ElementType> operator()( size_t n, const L& ll ) const {
       List<typename L::ElementType> l = ll;
-      while( n!=0 && !null(l) ) {
+      size_t k = known_length(l);
+      if( k != UNKNOWN_LENGTH && n >= k )
+         return NIL;
+      if( n!=0 && EnumRanges<typename L::ElementType>::drop( l, n, l ) )
+         return l;
+      ListBufferSpan<typename L::ElementType> s;
+      while( n!=0 ) {
+         if( s.find(l) )
+            return s.slice( n < s.size() ? n : s.size(), s.size() );
+         if( null(l) )
+            break;
          --n;
          l = tail(l);
       }
@@ -837,6 +1174,7 @@ FCPP_MAYBE_EXTERN DropWhile dropWhile;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
 namespace impl {
+#ifdef FCPP_SIMPLE_PRELUDE
 struct XReplicate {
    template <class N, class T>
    struct Sig : public FunType<N,T,OddList<T> > {};
@@ -846,6 +1184,33 @@ struct XReplicate {
       return take( n, repeat(x) );
    }
 };
+#else
+template <class T>
+struct XReplicateHelp : public ListStream<T> {
+   T x;
+   mutable size_t n;
+   XReplicateHelp( size_t nn, const T& xx ) : x(xx), n(nn) {}
+   bool next( StreamSlot<T>& s ) const {
+      if( n==0 )
+         return false;
+      --n;
+      s.put( x );
+      return true;
+   }
+   size_t size() const { return n; }
+};
+struct XReplicate {
+   template <class N, class T>
+   struct Sig : public FunType<N,T,List<T> > {};
+
+   template <class T>
+   List<T> operator()( size_t n, const T& x ) const {
+      if( n==0 )
+         return NIL;
+      return Fun0< OddList<T> >(1, new XReplicateHelp<T>( n, x ));
+   }
+};
+#endif
 }
 typedef Full2<impl::XReplicate> Replicate;
 FCPP_MAYBE_NAMESPACE_OPEN
@@ -882,13 +1247,147 @@ FCPP_MAYBE_EXTERN Cycle cycle;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
 namespace impl {
+// span() and splitAt() make both of their lists from one walk of the
+// input, shared through a SpanState: whichever list gets ahead walks
+// for both, testing each element just once, and keeps the elements of
+// the first list that that list hasn't got to yet (unless nobody holds
+// that list any more).  The two lists may be forced from different
+// threads, so the state has a lock (under FCPP_THREADSAFE).
+struct SplitMutex {
+#ifdef FCPP_THREADSAFE
+   std::mutex m;
+   void lock() { m.lock(); }
+   void unlock() { m.unlock(); }
+#else
+   void lock() {}
+   void unlock() {}
+#endif
+};
+class SplitLock {
+   SplitMutex& m;
+   SplitLock( const SplitLock& );
+   void operator=( const SplitLock& );
+public:
+   explicit SplitLock( SplitMutex& mm ) : m(mm) { m.lock(); }
+   ~SplitLock() { m.unlock(); }
+};
+
+// splitAt's "predicate" just counts, and needn't look at the element
+struct SplitCount {
+   size_t n;
+   explicit SplitCount( size_t nn ) : n(nn) {}
+};
+template <class P, class T>
+bool span_accepts( P& p, const List<T>& l ) {
+   return !null(l) && p( head(l) );
+}
+template <class T>
+bool span_accepts( SplitCount& c, const List<T>& l ) {
+   if( c.n == 0 || null(l) )
+      return false;
+   --c.n;
+   return true;
+}
+
+template <class T, class P>
+struct SpanState {
+   SplitMutex m;
+   P p;
+   List<T> l;         // the input, from the first element not yet tested
+   std::deque<T> q;   // tested and accepted, but not yet in the first list
+   bool done;         // l starts the second list
+   bool want_first;   // the first list is still around
+   SpanState( const P& pp, const List<T>& ll ) 
+      : p(pp), l(ll), done(false), want_first(true) {}
+
+   bool next( StreamSlot<T>& x ) {
+      if( !q.empty() ) {
+         x.put( std::move( q.front() ) );
+         q.pop_front();
+         return true;
+      }
+      if( done )
+         return false;
+      if( !span_accepts( p, l ) ) {
+         done = true;
+         return false;
+      }
+      x.put( head(l) );
+      l = tail(l);
+      return true;
+   }
+   // The second list; the state lets go of it, so that it can be read
+   // and dropped while the first list is still held
+   OddList<T> rest() {
+      while( !done ) {
+         if( !span_accepts( p, l ) )
+            done = true;
+         else {
+            if( want_first )
+               q.push_back( head(l) );
+            l = tail(l);
+         }
+      }
+      OddList<T> r = l.force();
+      l = NIL;
+      return r;
+   }
+};
+
+template <class T, class P>
+struct XSpanFirst : public ListStream<T> {
+   Ref<SpanState<T,P> > st;
+   XSpanFirst( const Ref<SpanState<T,P> >& s ) : st(s) {}
+   ~XSpanFirst() {
+      SplitLock lock( st->m );
+      st->want_first = false;
+      st->q.clear();
+   }
+   bool next( StreamSlot<T>& x ) const {
+      SplitLock lock( st->m );
+      return st->next( x );
+   }
+};
+template <class T, class P>
+struct XSpanSecond : public Fun0Impl< OddList<T> > {
+   Ref<SpanState<T,P> > st;
+   XSpanSecond( const Ref<SpanState<T,P> >& s ) : st(s) {}
+   OddList<T> operator()() const {
+      SplitLock lock( st->m );
+      return st->rest();
+   }
+};
+
+template <class T, class P>
+std::pair<List<T>,List<T> > span_split( const P& p, const List<T>& l ) {
+   Ref<SpanState<T,P> > st = makeRef<SpanState<T,P> >( p, l );
+   return std::make_pair( 
+      List<T>( Fun0< OddList<T> >( 1, new XSpanFirst<T,P>( st ) ) ),
+      List<T>( Fun0< OddList<T> >( 1, new XSpanSecond<T,P>( st ) ) ) );
+}
+}
+
+namespace impl {
+#ifdef FCPP_SIMPLE_PRELUDE
 struct XSplitAt {
    template <class N, class L>
    struct Sig : public FunType<N,L,std::pair<List<typename
       L::ElementType>,List<typename L::ElementType> > > {};
 
-   template <class T>
-   std::pair<List<T>,List<T> > operator()( size_t n, const List<T>& l ) const {
+   template <class L>
+   std::pair<List<typename L::ElementType>,List<typename L::ElementType> > 
+   operator()( size_t n, const L& ll ) const {
+      typedef typename L::ElementType T;
+      List<T> l = ll;
+      size_t k = known_length(l);
+      if( k != UNKNOWN_LENGTH && n >= k )
+         return std::make_pair( l, List<T>() );
+      ListBufferSpan<T> s;
+      if( n!=0 && s.find(l) ) {
+         if( n > s.size() )
+            n = s.size();
+         return std::make_pair( s.slice(0,n), s.slice(n,s.size()) );
+      }
       if( n==0 || null(l) )
          return std::make_pair( List<T>(), l );
       else {
@@ -898,6 +1397,32 @@ struct XSplitAt {
       }
    }
 };
+#else
+struct XSplitAt {
+   template <class N, class L>
+   struct Sig : public FunType<N,L,std::pair<List<typename
+      L::ElementType>,List<typename L::ElementType> > > {};
+
+   template <class L>
+   std::pair<List<typename L::ElementType>,List<typename L::ElementType> > 
+   operator()( size_t n, const L& ll ) const {
+      typedef typename L::ElementType T;
+      List<T> l = ll;
+      size_t k = known_length(l);
+      if( k != UNKNOWN_LENGTH && n >= k )
+         return std::make_pair( l, List<T>() );
+      if( n==0 )
+         return std::make_pair( List<T>(), l );
+      ListBufferSpan<T> s;
+      if( s.find(l) ) {
+         if( n > s.size() )
+            n = s.size();
+         return std::make_pair( s.slice(0,n), s.slice(n,s.size()) );
+      }
+      return span_split( SplitCount(n), l );
+   }
+};
+#endif
 }
 typedef Full2<impl::XSplitAt> SplitAt;
 FCPP_MAYBE_NAMESPACE_OPEN
@@ -905,14 +1430,17 @@ FCPP_MAYBE_EXTERN SplitAt splitAt;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
 namespace impl {
+#ifdef FCPP_SIMPLE_PRELUDE
 struct XSpan {
    template <class P, class L>
    struct Sig : public FunType<P,L,std::pair<List<typename
       L::ElementType>,List<typename L::ElementType> > > {};
 
-   template <class P, class T>
-   std::pair<List<T>,List<T> > 
-   operator()( const P& p, const List<T>& l ) const {
+   template <class P, class L>
+   std::pair<List<typename L::ElementType>,List<typename L::ElementType> > 
+   operator()( const P& p, const L& ll ) const {
+      typedef typename L::ElementType T;
+      List<T> l = ll;
       if( null(l) || !p(head(l)) )
          return std::make_pair( List<T>(), l );
       else {
@@ -922,6 +1450,19 @@ struct XSpan {
       }
    }
 };
+#else
+struct XSpan {
+   template <class P, class L>
+   struct Sig : public FunType<P,L,std::pair<List<typename
+      L::ElementType>,List<typename L::ElementType> > > {};
+
+   template <class P, class L>
+   std::pair<List<typename L::ElementType>,List<typename L::ElementType> > 
+   operator()( const P& p, const L& l ) const {
+      return span_split( p, List<typename L::ElementType>( l ) );
+   }
+};
+#endif
 }
 typedef Full2<impl::XSpan> Span;
 FCPP_MAYBE_NAMESPACE_OPEN
@@ -934,9 +1475,9 @@ struct XBreak {
    struct Sig : public FunType<P,L,std::pair<List<typename
       L::ElementType>,List<typename L::ElementType> > > {};
 
-   template <class P, class T>
-   std::pair<List<T>,List<T> > 
-   operator()( const P& p, const List<T>& l ) const {
+   template <class P, class L>
+   std::pair<List<typename L::ElementType>,List<typename L::ElementType> > 
+   operator()( const P& p, const L& l ) const {
       return span( Compose()( LogicalNot(), p ), l );
    }
 };
@@ -1059,6 +1600,78 @@ FCPP_MAYBE_NAMESPACE_OPEN
 FCPP_MAYBE_EXTERN Any any;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
+// listIndex(l) reads the finite list l into a hash table, once, and
+// returns an IndexedList: l together with that table.  elem(x,ix),
+// notElem(x,ix) and, for a list of pairs, lookup(k,ix) then take O(1)
+// instead of a walk of l.  Copies of an IndexedList share the table.
+// The elements (or, for pairs, the keys) need a std::hash.
+// Only an IndexedList is fast: nothing is kept on l itself (that would
+// cost every list node a word), so elem(x,l) on a plain list still
+// walks it, however often it is asked.  Keep the IndexedList around.
+template <class T>
+class IndexedList {
+   List<T> l;
+   Ref<std::unordered_set<T> > set;
+public:
+   typedef T ElementType;
+   explicit IndexedList( const List<T>& ll ) 
+      : l(ll), set( makeRef<std::unordered_set<T> >() ) {
+      for( const T& x : view(l) )
+         set->insert( x );
+   }
+   const List<T>& list() const { return l; }
+   bool has( const T& x ) const { return set->count( x ) != 0; }
+};
+
+// A list of pairs is indexed by key, keeping the first value for each
+// key, as lookup() wants
+template <class K, class V>
+class IndexedList<std::pair<K,V> > {
+   typedef std::pair<K,V> T;
+   List<T> l;
+   Ref<std::unordered_map<K,V> > map;
+public:
+   typedef T ElementType;
+   explicit IndexedList( const List<T>& ll ) 
+      : l(ll), map( makeRef<std::unordered_map<K,V> >() ) {
+      for( const T& x : view(l) )
+         map->insert( x );   // doesn't replace an earlier one
+   }
+   const List<T>& list() const { return l; }
+   const V* find( const K& k ) const {
+      typename std::unordered_map<K,V>::const_iterator i = map->find( k );
+      return i == map->end() ? 0 : &i->second;
+   }
+   // Only a key with more than one value ever needs a walk
+   bool has( const T& x ) const {
+      const V* v = find( x.first );
+      if( !v )
+         return false;
+      if( *v == x.second )
+         return true;
+      for( const T& y : view(l) )
+         if( y == x )
+            return true;
+      return false;
+   }
+};
+
+namespace impl {
+struct XListIndex {
+   template <class L>
+   struct Sig : public FunType<L,IndexedList<typename L::ElementType> > {};
+
+   template <class L>
+   IndexedList<typename L::ElementType> operator()( const L& l ) const {
+      return IndexedList<typename L::ElementType>( l );
+   }
+};
+}
+typedef Full1<impl::XListIndex> ListIndex;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN ListIndex listIndex;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
 namespace impl {
 struct XElem {
    template <class T, class L>
@@ -1066,8 +1679,15 @@ struct XElem {
 
    template <class T, class L>
    bool operator()( const T& x, const L& l ) const {
+      bool found;
+      if( EnumRanges<typename L::ElementType>::elem( x, l, found ) )
+         return found;
       return any( equal(x), l );
    }
+   template <class T, class U>
+   bool operator()( const T& x, const IndexedList<U>& ix ) const {
+      return ix.has( x );
+   }
 };
 }
 typedef Full2<impl::XElem> Elem;
@@ -1082,7 +1702,7 @@ struct XNotElem {
 
    template <class T, class L>
    bool operator()( const T& x, const L& l ) const {
-      return all( notEqual(x), l );
+      return !elem( x, l );
    }
 };
 }
@@ -1091,14 +1711,375 @@ FCPP_MAYBE_NAMESPACE_OPEN
 FCPP_MAYBE_EXTERN NotElem notElem;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
+namespace impl {
+// Merges the runs of src in pairs into dst (runs are offsets from src,
+// and become the offsets of the merged runs)
+template <class It, class Out, class Cmp>
+void merge_runs( It src, Out dst, std::vector<size_t>& runs, 
+                 const Cmp& cmp ) {
+   std::vector<size_t> merged( 1, 0 );
+   size_t r = 0;
+   for( ; r+2 < runs.size(); r += 2 ) {
+      dst = std::merge( std::make_move_iterator( src+runs[r] ),
+                        std::make_move_iterator( src+runs[r+1] ),
+                        std::make_move_iterator( src+runs[r+1] ),
+                        std::make_move_iterator( src+runs[r+2] ),
+                        dst, cmp );
+      merged.push_back( runs[r+2] );
+   }
+   if( r+1 < runs.size() ) {   // an odd run out
+      std::move( src+runs[r], src+runs[r+1], dst );
+      merged.push_back( runs[r+1] );
+   }
+   runs.swap( merged );
+}
+
+// Sorts v[b..] stably with cmp (a "less than"), in O(n) if it is in
+// order already: runs that are in order (or strictly in reverse) are
+// found, short ones are grown to MIN_RUN by insertion, and then the runs
+// are merged in pairs, back and forth between v and a buffer.
+template <class T, class Cmp>
+void merge_sort( std::vector<T>& v, size_t b, const Cmp& cmp ) {
+   const size_t MIN_RUN = 32;
+   size_t n = v.size();
+   std::vector<size_t> runs( 1, 0 );
+   for( size_t i = b; i < n; i = b + runs.back() ) {
+      size_t j = i + 1;
+      if( j < n && cmp( v[j], v[i] ) ) {
+         while( j < n && cmp( v[j], v[j-1] ) )
+            ++j;
+         std::reverse( v.begin()+i, v.begin()+j );
+      }
+      else
+         while( j < n && !cmp( v[j], v[j-1] ) )
+            ++j;
+      for( size_t e = std::min( n, i + MIN_RUN ); j < e; ++j ) {
+         T x( std::move( v[j] ) );
+         typename std::vector<T>::iterator p = 
+            std::upper_bound( v.begin()+i, v.begin()+j, x, cmp );
+         std::move_backward( p, v.begin()+j, v.begin()+j+1 );
+         *p = std::move( x );
+      }
+      runs.push_back( j - b );
+   }
+   if( runs.size() <= 2 )
+      return;
+   std::vector<T> buf;
+   buf.reserve( n - b );
+   merge_runs( v.begin()+b, std::back_inserter( buf ), runs, cmp );
+   bool in_buf = true;
+   for( ; runs.size() > 2; in_buf = !in_buf )
+      if( in_buf )
+         merge_runs( buf.begin(), v.begin()+b, runs, cmp );
+      else
+         merge_runs( v.begin()+b, buf.begin(), runs, cmp );
+   if( in_buf )
+      std::move( buf.begin(), buf.end(), v.begin()+b );
+}
+
+// The list a sort() makes.  The input is read into a vector (copied
+// straight out, if it is an unwalked buffer_list), and sorted, when the
+// first element is wanted; after that the elements are moved out of the
+// vector one at a time.
+template <class T, class Cmp>
+struct XSortHelp : public SortStream<T> {
+   Cmp cmp;
+   mutable List<T> in;
+   mutable bool read;
+   mutable std::vector<T> v;
+   mutable size_t i;        // the next one to hand out
+   mutable size_t sorted;   // v[0..sorted) is in its final order
+   XSortHelp( const Cmp& c, List<T>&& l ) 
+      : cmp(c), in(std::move(l)), read(false), i(0), sorted(0) {}
+
+   // If the input throws part way, what has been read so far stays in
+   // v and the rest goes back in 'in', so the next force carries on
+   // from there; 'read' is only set once all of it is in v.
+   void fill() const {
+      if( read )
+         return;
+      ListBufferSpan<T> s;
+      if( v.empty() && s.find( in ) ) {
+         v.assign( s.buf->begin()+s.i, s.buf->begin()+s.j );
+         in = NIL;
+         read = true;
+         return;
+      }
+      ListSource<T> l( std::move(in) );
+      size_t n = l.size();
+      if( n != UNKNOWN_LENGTH )
+         v.reserve( v.size() + n );
+      StreamSlot<T> x;
+      try {
+         while( !l.is_shared() && l.next(x) )
+            v.push_back( std::move( x.get() ) );
+      }
+      catch( ... ) {
+         in = l.remaining();
+         throw;
+      }
+      List<T> r = l.rest();
+      size_t k = v.size();
+      try {
+         for( const T& y : view( r ) )
+            v.push_back( y );
+      }
+      catch( ... ) {
+         in = drop( v.size() - k, r );
+         throw;
+      }
+      read = true;
+   }
+   bool next( StreamSlot<T>& x ) const {
+      fill();
+      if( i == sorted ) {
+         if( i == v.size() ) {
+            std::vector<T>().swap( v );
+            return false;
+         }
+         merge_sort( v, i, cmp );
+         sorted = v.size();
+      }
+      x.put( std::move( v[i++] ) );
+      return true;
+   }
+   size_t size() const {
+      if( read )
+         return v.size() - i;
+      size_t n = known_length(in);
+      return n == UNKNOWN_LENGTH ? n : v.size() + n;
+   }
+
+   struct Before {
+      const Cmp& cmp;
+      const std::vector<T>& v;
+      Before( const Cmp& c, const std::vector<T>& vv ) : cmp(c), v(vv) {}
+      bool operator()( size_t a, size_t b ) const {
+         return cmp( v[a], v[b] ) || ( a < b && !cmp( v[b], v[a] ) );
+      }
+   };
+   // Picks out the first k with a heap of the k best so far, ties going
+   // to the one that came first (so the result is still stable), and
+   // puts them, in order, in front of the others
+   void prefix( size_t k ) const {
+      if( read )
+         return;
+      fill();
+      size_t n = v.size();
+      if( k >= n / 8 )
+         return;
+      Before before( cmp, v );
+      std::vector<size_t> h;
+      h.reserve( k );
+      for( size_t j = 0; j < n; ++j )
+         if( h.size() < k ) {
+            h.push_back( j );
+            std::push_heap( h.begin(), h.end(), before );
+         }
+         else if( before( j, h.front() ) ) {
+            std::pop_heap( h.begin(), h.end(), before );
+            h.back() = j;
+            std::push_heap( h.begin(), h.end(), before );
+         }
+      std::sort_heap( h.begin(), h.end(), before );
+      std::vector<char> picked( n, 0 );
+      std::vector<T> w;
+      w.reserve( n );
+      for( size_t j = 0; j < k; ++j ) {
+         picked[ h[j] ] = 1;
+         w.push_back( std::move( v[ h[j] ] ) );
+      }
+      for( size_t j = 0; j < n; ++j )
+         if( !picked[j] )
+            w.push_back( std::move( v[j] ) );
+      v.swap( w );
+      sorted = k;
+   }
+};
+
+// sortBy takes a "less than", not Haskell's a -> a -> Ordering
+struct XSortBy {
+   template <class Cmp, class L>
+   struct Sig : public FunType<Cmp,L,List<typename L::ElementType> > {};
+
+   template <class Cmp, class L>
+   List<typename L::ElementType> operator()( const Cmp& cmp, L l ) const {
+      typedef typename L::ElementType T;
+      return Fun0< OddList<T> >( 1, 
+         new XSortHelp<T,Cmp>( cmp, List<T>( std::move(l) ) ) );
+   }
+};
+}
+typedef Full2<impl::XSortBy> SortBy;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN SortBy sortBy;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XSort {
+   template <class L>
+   struct Sig : public FunType<L,List<typename L::ElementType> > {};
+
+   template <class L>
+   List<typename L::ElementType> operator()( L l ) const {
+      return XSortBy()( Less(), std::move(l) );
+   }
+};
+}
+typedef Full1<impl::XSort> Sort;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN Sort sort;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+#ifdef FCPP_SIMPLE_PRELUDE
+struct XInsert {
+   template <class T, class L>
+   struct Sig : public FunType<T,L,List<typename L::ElementType> > {};
+
+   template <class T, class U>
+   List<U> operator()( const T& x, const List<U>& l ) const {
+      if( null(l) || !( head(l) < x ) )
+         return cons( U(x), l );
+      else
+         return cons( head(l), curry2( XInsert(), x, tail(l) ) );
+   }
+};
+#else
+struct XInsert {
+   template <class T, class L>
+   struct Sig : public FunType<T,L,OddList<typename L::ElementType> > {};
+
+   template <class T, class L>
+   OddList<typename L::ElementType> operator()( const T& x, const L& ll,
+         Reuser2<Inv,Inv,Var,XInsert,T,List<typename L::ElementType> > 
+         r = NIL ) const {
+      typedef typename L::ElementType U;
+      List<U> l = ll;
+      if( null(l) || !( head(l) < x ) )
+         return cons( U(x), l );
+      else
+         return cons( head(l), r( XInsert(), x, tail(l) ) );
+   }
+};
+#endif
+}
+typedef Full2<impl::XInsert> Insert;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN Insert insert;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+// Each group is made whole (with a ListBuilder) when it is reached; the
+// element that ends a group is kept to start the next one
+template <class T, class Eq>
+struct XGroupByHelp : public ListStream< List<T> > {
+   Eq eq;
+   mutable ListSource<T> in;
+   mutable StreamSlot<T> first;
+   mutable bool have;       // first holds the start of the next group
+   XGroupByHelp( const Eq& e, List<T>&& l ) 
+      : eq(e), in(std::move(l)), have(false) {}
+   bool next( StreamSlot< List<T> >& x ) const {
+      if( !have && !in.next( first ) )
+         return false;
+      ListBuilder<T> b;
+      b.push_back( first.get() );
+      StreamSlot<T> y;
+      have = false;
+      while( in.next( y ) ) {
+         if( !eq( first.get(), y.get() ) ) {
+            first.put( std::move( y.get() ) );
+            have = true;
+            break;
+         }
+         b.push_back( std::move( y.get() ) );
+      }
+      x.put( b.finish() );
+      return true;
+   }
+};
+struct XGroupBy {
+   template <class Eq, class L>
+   struct Sig : public 
+      FunType<Eq,L,List<List<typename L::ElementType> > > {};
+
+   template <class Eq, class L>
+   List<List<typename L::ElementType> > 
+   operator()( const Eq& eq, L l ) const {
+      typedef typename L::ElementType T;
+      return Fun0< OddList<List<T> > >( 1, 
+         new XGroupByHelp<T,Eq>( eq, List<T>( std::move(l) ) ) );
+   }
+};
+}
+typedef Full2<impl::XGroupBy> GroupBy;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN GroupBy groupBy;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+struct XGroup {
+   template <class L>
+   struct Sig : public FunType<L,List<List<typename L::ElementType> > > {};
+
+   template <class L>
+   List<List<typename L::ElementType> > operator()( L l ) const {
+      return XGroupBy()( Equal(), std::move(l) );
+   }
+};
+}
+typedef Full1<impl::XGroup> Group;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN Group group;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
+namespace impl {
+// nub remembers what it has handed out in a hash set (so the elements
+// need a std::hash), rather than looking back along its output
+template <class T>
+struct XNubHelp : public ListStream<T> {
+   mutable ListSource<T> in;
+   mutable std::unordered_set<T> seen;
+   XNubHelp( List<T>&& l ) : in(std::move(l)) {}
+   bool next( StreamSlot<T>& x ) const {
+      while( in.next( x ) )
+         if( seen.insert( x.get() ).second )
+            return true;
+      return false;
+   }
+};
+struct XNub {
+   template <class L>
+   struct Sig : public FunType<L,List<typename L::ElementType> > {};
+
+   template <class L>
+   List<typename L::ElementType> operator()( L l ) const {
+      typedef typename L::ElementType T;
+      return Fun0< OddList<T> >( 1, 
+         new XNubHelp<T>( List<T>( std::move(l) ) ) );
+   }
+};
+}
+typedef Full1<impl::XNub> Nub;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN Nub nub;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
 namespace impl {
 struct XSum {
    template <class L>
    struct Sig : public FunType<L,typename L::ElementType> {};
 
+   // A buffer_list is summed by a vector kernel (see simd.h)
    template <class L>
-   typename L::ElementType operator()( const L& l ) const {
-      return foldl( plus, 0, l );
+   typename L::ElementType operator()( L l ) const {
+      typedef typename L::ElementType T;
+      List<T> m( std::move(l) );
+      StreamSlot<T> r;
+      if( buffer_reduce<Plus>( m, r ) )
+         return plus( T(0), r.get() );
+      return foldl( plus, T(0), std::move(m) );
    }
 };
 }
@@ -1113,8 +2094,13 @@ struct XProduct {
    struct Sig : public FunType<L,typename L::ElementType> {};
 
    template <class L>
-   typename L::ElementType operator()( const L& l ) const {
-      return foldl( multiplies, 1, l );
+   typename L::ElementType operator()( L l ) const {
+      typedef typename L::ElementType T;
+      List<T> m( std::move(l) );
+      StreamSlot<T> r;
+      if( buffer_reduce<Multiplies>( m, r ) )
+         return r.get();
+      return foldl( multiplies, T(1), std::move(m) );
    }
 };
 }
@@ -1130,7 +2116,12 @@ struct XMinimum {
 
    template <class L>
    typename L::ElementType operator()( const L& l ) const {
-      return foldl1( min, l );
+      typedef typename L::ElementType T;
+      List<T> m( l );
+      StreamSlot<T> r;
+      if( buffer_reduce<Min>( m, r ) )
+         return r.get();
+      return foldl1( min, m );
    }
 };
 }
@@ -1146,7 +2137,12 @@ struct XMaximum {
 
    template <class L>
    typename L::ElementType operator()( const L& l ) const {
-      return foldl1( max, l );
+      typedef typename L::ElementType T;
+      List<T> m( l );
+      StreamSlot<T> r;
+      if( buffer_reduce<Max>( m, r ) )
+         return r.get();
+      return foldl1( max, m );
    }
 };
 }
@@ -1174,7 +2170,7 @@ struct XZipWith {
    }
 };
 #else
-struct XZipWith {
+struct XZipWithHelp {
    template <class Z, class LA, class LB>
    struct Sig : public FunType<Z,LA,LB,
    OddList<typename RT<Z,typename LA::ElementType,
@@ -1184,14 +2180,35 @@ struct XZipWith {
    OddList<typename RT<Z,typename LA::ElementType,
                          typename LB::ElementType>::ResultType> 
    operator()( const Z& z, const LA& a, const LB& b,
-               Reuser3<Inv,Inv,Var,Var,XZipWith,Z,
+               Reuser3<Inv,Inv,Var,Var,XZipWithHelp,Z,
                   List<typename LA::ElementType>,
                   List<typename LB::ElementType> > r = NIL ) const {
       if( null(a) || null(b) )
          return NIL;
       else
          return cons( z(head(a),head(b)),
-            r( XZipWith(), z, tail(a), tail(b) ) );
+            r( XZipWithHelp(), z, tail(a), tail(b) ) );
+   }
+};
+struct XZipWith {
+   template <class Z, class LA, class LB>
+   struct Sig : public FunType<Z,LA,LB,
+   OddList<typename RT<Z,typename LA::ElementType,
+                         typename LB::ElementType>::ResultType> > {};
+
+   // Two buffer_lists are zipped by a vector kernel (see simd.h)
+   template <class Z, class LA, class LB>
+   OddList<typename RT<Z,typename LA::ElementType,
+                         typename LB::ElementType>::ResultType> 
+   operator()( const Z& z, const LA& a, const LB& b ) const {
+      typedef typename LA::ElementType A;
+      typedef typename LB::ElementType B;
+      List<A> la( a );
+      List<B> lb( b );
+      List<typename RT<Z,A,B>::ResultType> r;
+      if( buffer_zip<Z>( la, lb, r ) )
+         return r;
+      return XZipWithHelp()( z, la, lb );
    }
 };
 #endif
@@ -1253,6 +2270,7 @@ FCPP_MAYBE_EXTERN Snd snd;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
 namespace impl {
+#ifdef FCPP_SIMPLE_PRELUDE
 struct XUnzip {
    template <class LPT>
    struct Sig : public FunType<LPT,std::pair<
@@ -1270,6 +2288,112 @@ struct XUnzip {
                              List<S>(curry2(map,snd,l))  );
    }
 };
+#else
+// Like span(), unzip() reads its input once for both lists, keeping the
+// halves that one list has read ahead of the other
+template <class PT>
+struct UnzipState {
+   typedef typename PT::first_type F;
+   typedef typename PT::second_type S;
+   SplitMutex m;
+   ListSource<PT> in;
+   std::deque<F> fs;
+   std::deque<S> ss;
+   bool want_f, want_s;    // nobody holds the list any more when false
+   UnzipState( List<PT>&& l ) 
+      : in(std::move(l)), want_f(true), want_s(true) {}
+
+   bool first( StreamSlot<F>& x ) {
+      if( !fs.empty() ) {
+         x.put( std::move( fs.front() ) );
+         fs.pop_front();
+         return true;
+      }
+      StreamSlot<PT> y;
+      if( !in.next(y) )
+         return false;
+      if( want_s )
+         ss.push_back( std::move( y.get().second ) );
+      x.put( std::move( y.get().first ) );
+      return true;
+   }
+   bool second( StreamSlot<S>& x ) {
+      if( !ss.empty() ) {
+         x.put( std::move( ss.front() ) );
+         ss.pop_front();
+         return true;
+      }
+      StreamSlot<PT> y;
+      if( !in.next(y) )
+         return false;
+      if( want_f )
+         fs.push_back( std::move( y.get().first ) );
+      x.put( std::move( y.get().second ) );
+      return true;
+   }
+   size_t size( size_t ahead ) const {
+      size_t n = in.size();
+      return n == UNKNOWN_LENGTH ? n : n + ahead;
+   }
+};
+template <class PT>
+struct XUnzipFirst : public ListStream<typename PT::first_type> {
+   Ref<UnzipState<PT> > st;
+   XUnzipFirst( const Ref<UnzipState<PT> >& s ) : st(s) {}
+   ~XUnzipFirst() {
+      SplitLock lock( st->m );
+      st->want_f = false;
+      st->fs.clear();
+   }
+   bool next( StreamSlot<typename PT::first_type>& x ) const {
+      SplitLock lock( st->m );
+      return st->first( x );
+   }
+   size_t size() const {
+      SplitLock lock( st->m );
+      return st->size( st->fs.size() );
+   }
+};
+template <class PT>
+struct XUnzipSecond : public ListStream<typename PT::second_type> {
+   Ref<UnzipState<PT> > st;
+   XUnzipSecond( const Ref<UnzipState<PT> >& s ) : st(s) {}
+   ~XUnzipSecond() {
+      SplitLock lock( st->m );
+      st->want_s = false;
+      st->ss.clear();
+   }
+   bool next( StreamSlot<typename PT::second_type>& x ) const {
+      SplitLock lock( st->m );
+      return st->second( x );
+   }
+   size_t size() const {
+      SplitLock lock( st->m );
+      return st->size( st->ss.size() );
+   }
+};
+struct XUnzip {
+   template <class LPT>
+   struct Sig : public FunType<LPT,std::pair<
+      List<typename LPT::ElementType::first_type>,
+      List<typename LPT::ElementType::second_type> > > {};
+
+   template <class LPT>
+   std::pair<
+      List<typename LPT::ElementType::first_type>,
+      List<typename LPT::ElementType::second_type> >
+   operator()( LPT l ) const {
+      typedef typename LPT::ElementType PT;
+      typedef typename PT::first_type F;
+      typedef typename PT::second_type S;
+      Ref<UnzipState<PT> > st = 
+         makeRef<UnzipState<PT> >( List<PT>( std::move(l) ) );
+      return std::make_pair( 
+         List<F>( Fun0< OddList<F> >( 1, new XUnzipFirst<PT>( st ) ) ),
+         List<S>( Fun0< OddList<S> >( 1, new XUnzipSecond<PT>( st ) ) ) );
+   }
+};
+#endif
 }
 typedef Full1<impl::XUnzip> Unzip;
 FCPP_MAYBE_NAMESPACE_OPEN
@@ -1346,45 +2470,30 @@ FCPP_MAYBE_NAMESPACE_CLOSE
 // Not HSP but close
 //////////////////////////////////////////////////////////////////////
 
-// For some unknown reason, g++2.95.2 (for Solaris, at least) generates
-// poor code when these next two functoids are templates.  (g++3 does
-// fine, regardless.)  As a result, we make them just work with ints,
-// unless the user #defines the flag below.
+// enumFrom and enumFromTo work on any type with ++, == and < (all the
+// integral types, random-access iterators, pointers, ...); the range
+// itself is EnumRange, near the top of this file.  A range of integers
+// stops at the largest value of its type rather than overflowing, so
+// enumFrom(x) is finite for them.
 namespace impl {
-#ifdef FCPP_TEMPLATE_ENUM
-template <class T>
-struct XEFH : public Fun0Impl< OddList<T> > {
-   mutable T x;
-   XEFH( const T& xx ) : x(xx) {}
-   OddList<T> operator()() const {
-      ++x;
-      return cons( x-1, Fun0<OddList<T> >(1,this) );
-   }
-};
 struct XEnumFrom {
    template <class T>
    struct Sig : FunType<T,List<T> > {};
 
    template <class T>
    List<T> operator()( const T& x ) const {
-      return Fun0<OddList<T> >(1, new XEFH<T>(x) );
+      return make( x, typename std::is_integral<T>::type() );
    }
-};
-#else
-struct XEFH : public Fun0Impl< OddList<int> > {
-   mutable int x;
-   XEFH( int xx ) : x(xx) {}
-   OddList<int> operator()() const {
-      ++x;
-      return cons( x-1, Fun0<OddList<int> >(1,this) );
+   template <class T>
+   static List<T> make( const T& x, std::true_type ) {
+      return Fun0<OddList<T> >(1, 
+                new XEFTH<T>( x, std::numeric_limits<T>::max() ) );
    }
-};
-struct XEnumFrom : CFunType<int,List<int> > {
-   List<int> operator()( int x ) const {
-      return Fun0<OddList<int> >(1, new XEFH(x) );
+   template <class T>
+   static List<T> make( const T& x, std::false_type ) {
+      return Fun0<OddList<T> >(1, new XEFH<T>(x) );
    }
 };
-#endif
 }
 typedef Full1<impl::XEnumFrom> EnumFrom;
 FCPP_MAYBE_NAMESPACE_OPEN
@@ -1392,47 +2501,18 @@ FCPP_MAYBE_EXTERN EnumFrom enumFrom;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
 namespace impl {
-#ifdef FCPP_TEMPLATE_ENUM
-template <class T>
-struct XEFTH : public Fun0Impl<OddList<T> > {
-   mutable T x;
-   T y;
-   XEFTH( const T& xx, const T& yy ) : x(xx), y(yy) {}
-   OddList<T> operator()() const {
-      if( x > y )
-         return NIL;
-      ++x;
-      return cons( x-1, Fun0<OddList<T> >( 1, this ) );
-   }
-};
+// Arguments of different types are converted to their common type
 struct XEnumFromTo {
-   template <class T, class U> struct Sig;
-   template <class T>
-   struct Sig<T,T> : FunType<T,T,List<T> > {};
+   template <class T, class U>
+   struct Sig : FunType<T,U,List<typename std::common_type<T,U>::type> > {};
 
-   template <class T>
-   List<T> operator()( const T& x, const T& y ) const {
-      return Fun0<OddList<T> >( 1, new XEFTH<T>(x,y) );
-   }
-};
-#else
-struct XEFTH : public Fun0Impl<OddList<int> > {
-   mutable int x;
-   int y;
-   XEFTH( const int& xx, const int& yy ) : x(xx), y(yy) {}
-   OddList<int> operator()() const {
-      if( x > y )
-         return NIL;
-      ++x;
-      return cons( x-1, Fun0<OddList<int> >( 1, this ) );
+   template <class T, class U>
+   List<typename std::common_type<T,U>::type> 
+   operator()( const T& x, const U& y ) const {
+      typedef typename std::common_type<T,U>::type V;
+      return Fun0<OddList<V> >( 1, new XEFTH<V>(x,y) );
    }
 };
-struct XEnumFromTo : CFunType<int,int,List<int> > {
-   List<int> operator()( const int& x, const int& y ) const {
-      return Fun0<OddList<int> >( 1, new XEFTH(x,y) );
-   }
-};
-#endif
 }
 typedef Full2<impl::XEnumFromTo> EnumFromTo;
 FCPP_MAYBE_NAMESPACE_OPEN
@@ -1474,6 +2554,7 @@ public:
    Maybe( AUniqueTypeForNothing ) {}
    Maybe() {}                                    // the Nothing constructor
    Maybe( const T& x ) : rep( cons(x,NIL) ) {}   // the Just constructor
+   Maybe( T&& x ) : rep( cons(std::move(x),NIL) ) {}
 
    bool is_nothing() const { return null(rep); }
    T value() const { return head(rep); }
@@ -1488,6 +2569,12 @@ namespace impl {
       operator()( const T& x ) const {
          return Maybe<T>( x );
       }
+      template <class T>
+      typename RvalueOnly<T,
+         typename Sig<typename Plain<T>::Type>::ResultType>::Type
+      operator()( T&& x ) const {
+         return Maybe<T>( std::move(x) );
+      }
    };
 }
 typedef Full1<impl::XJust> Just;
@@ -1495,6 +2582,38 @@ FCPP_MAYBE_NAMESPACE_OPEN
 FCPP_MAYBE_EXTERN Just just;
 FCPP_MAYBE_NAMESPACE_CLOSE
 
+// lookup(k,l) is the value paired with the first k in the list of pairs
+// l, or NOTHING.  Give it an IndexedList (see listIndex) to skip the walk.
+namespace impl {
+struct XLookup {
+   template <class K, class L>
+   struct Sig : public 
+      FunType<K,L,Maybe<typename L::ElementType::second_type> > {};
+
+   template <class K, class L>
+   Maybe<typename L::ElementType::second_type> 
+   operator()( const K& k, const L& ll ) const {
+      List<typename L::ElementType> l = ll;
+      for( ; !null(l); l = tail(l) )
+         if( head(l).first == k )
+            return head(l).second;
+      return NOTHING;
+   }
+   template <class K, class U, class V>
+   Maybe<V> operator()( const K& k, const IndexedList<std::pair<U,V> >& ix ) 
+   const {
+      const V* v = ix.find( k );
+      if( v )
+         return *v;
+      return NOTHING;
+   }
+};
+}
+typedef Full2<impl::XLookup> Lookup;
+FCPP_MAYBE_NAMESPACE_OPEN
+FCPP_MAYBE_EXTERN Lookup lookup;
+FCPP_MAYBE_NAMESPACE_CLOSE
+
 // Haskell's "()" type/value
 struct Empty {};
 FCPP_MAYBE_NAMESPACE_OPEN
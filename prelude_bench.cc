@@ -0,0 +1,481 @@
+//
+// Copyright (c) 2000-2003 Brian McNamara and Yannis Smaragdakis
+//
+// Permission to use, copy, modify, distribute and sell this software
+// and its documentation for any purpose is granted without fee,
+// provided that the above copyright notice and this permission notice
+// appear in all source code copies and supporting documentation. The
+// software is provided "as is" without any express or implied
+// warranty.
+
+//////////////////////////////////////////////////////////////////////
+// Microbenchmarks for the list functions in prelude.h.  Each function
+// is timed on lists of several lengths, next to a hand-written
+// std::vector version of the same computation.  Build it once for each
+// flavor of the prelude and compare:
+//
+//    g++ -O2 -std=c++11 -pthread -I. prelude_bench.cc -o bench_reuser
+//    g++ -O2 -std=c++11 -pthread -I. -DFCPP_SIMPLE_PRELUDE prelude_bench.cc -o bench_simple
+//
+//    ./bench_reuser [--json] [length ...]    (default: 1000 10000 100000)
+//
+// The output is CSV (or a JSON array with --json), one row per
+// (function, implementation, length):
+//    prelude    "reuser" or "simple"
+//    op         the prelude function
+//    impl       "fcpp", "chunked" (ChunkedList, for the functions chunked.h
+//               has) or "vector"
+//    n          list length
+//    ns_per_elt best-of-3 time, divided by n
+//    allocs_per_elt  calls to global operator new, divided by n
+//    nodes_per_elt   List nodes created, divided by n (needs FCPP_STATS;
+//                    empty/null otherwise)
+// List nodes and thunks come from the pool (pool.h), so allocs_per_elt
+// is mostly zero for "fcpp" rows; add -DFCPP_NO_POOL to see every node
+// and thunk as a heap allocation.  Comparing the two builds is how the
+// pool's saving is measured.  Destroying a list never recurses (see
+// release() in ref_count.h), but foldr does, so its longest lists may
+// need a larger stack (ulimit -s).
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "prelude.h"
+#include "chunked.h"
+#include "parallel.h"
+
+using namespace fcpp;
+
+//////////////////////////////////////////////////////////////////////
+// Counting global operator new
+//////////////////////////////////////////////////////////////////////
+
+static unsigned long heap_allocs = 0;
+
+// GCC sees operator delete call std::free on what it thinks came from
+// new, and warns; here new really does use malloc.
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new( std::size_t n ) {
+   ++heap_allocs;
+   if( void* p = std::malloc( n ? n : 1 ) )
+      return p;
+   throw std::bad_alloc();
+}
+void* operator new[]( std::size_t n ) { return operator new(n); }
+void operator delete( void* p ) noexcept { std::free(p); }
+void operator delete[]( void* p ) noexcept { std::free(p); }
+void operator delete( void* p, std::size_t ) noexcept { std::free(p); }
+void operator delete[]( void* p, std::size_t ) noexcept { std::free(p); }
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Helpers
+//////////////////////////////////////////////////////////////////////
+
+// Accumulate in a long, so that sums of long lists don't overflow int.
+struct XAddL {
+   template <class A, class B> struct Sig : public FunType<A,B,long> {};
+   long operator()( long a, int b ) const { return a + b; }
+   long operator()( int a, long b ) const { return a + b; }
+};
+typedef Full2<XAddL> AddL;
+AddL addL;
+
+// Walks (and so forces) a list, dropping each node as it goes.
+template <class L>
+long consume( L l ) {
+   long s = 0;
+   while( !null(l) ) {
+      s += head(l);
+      l = tail(l);
+   }
+   return s;
+}
+
+// Walks a held list with its iterators, or through a view
+long walk_iterator( const List<int>& l ) {
+   long s = 0;
+   for( List<int>::iterator i = l.begin(); i != l.end(); ++i )
+      s += *i;
+   return s;
+}
+
+long walk_view( const List<int>& l ) {
+   long s = 0;
+   for( const int& x : view( l ) )
+      s += x;
+   return s;
+}
+
+// [0,n), front to back, with a ListBuilder
+List<int> build_list( int n ) {
+   ListBuilder<int> b;
+   for( int i = 0; i < n; ++i )
+      b.push_back( i );
+   return b.finish();
+}
+
+template <class T>
+long consume_chunked( const ChunkedList<T>& c ) {
+   long s = 0;
+   for( typename ChunkedList<T>::iterator i = c.begin(); i != c.end(); ++i )
+      s += *i;
+   return s;
+}
+
+template <class V>
+long consume_vec( const V& v ) {
+   return std::accumulate( v.begin(), v.end(), 0L );
+}
+
+// A fully forced list [0,n), held for the duration of a benchmark.
+List<int> held_list( int from, int n ) {
+   List<int> l = enumFromTo( from, from+n-1 );
+   for( List<int> p = l; !null(p); p = tail(p) ) {}
+   return l;
+}
+
+struct Row {
+   const char* op;
+   const char* impl;
+   int n;
+   double ns_per_elt;
+   double allocs_per_elt;
+   double nodes_per_elt;
+};
+
+volatile long sink;
+
+// Repeat the body until roughly a million elements have gone through it,
+// three times over, and keep the fastest round.
+template <class F>
+Row measure( const char* op, const char* impl, int n, F f ) {
+   typedef std::chrono::steady_clock Clock;
+   long reps = 1000000 / n;
+   if( reps < 1 ) reps = 1;
+   sink = f();   // warm-up
+   double best = 0;
+   unsigned long allocs = 0, nodes = 0;
+   for( int round = 0; round < 3; ++round ) {
+      reset_stats();
+      unsigned long a0 = heap_allocs;
+      Clock::time_point t0 = Clock::now();
+      for( long r = 0; r < reps; ++r )
+         sink = f();
+      double ns = std::chrono::duration<double,std::nano>(
+                     Clock::now() - t0 ).count();
+      if( round == 0 || ns < best )
+         best = ns;
+      allocs = heap_allocs - a0;
+      nodes = stats().cache_allocs;
+   }
+   double elts = double(reps) * n;
+   Row row = { op, impl, n, best / elts, allocs / elts, nodes / elts };
+   return row;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Sanity checks, run before timing anything, for bugs which would make
+// the numbers meaningless
+//////////////////////////////////////////////////////////////////////
+
+// A list built in an outer ListArena and forced inside inner ones must
+// get its tail nodes from the outer arena, not from whichever inner
+// arena happens to be in use.
+bool arenas_nest() {
+   ListArena outer;
+   List<int> l = map( inc, enumFromTo( 1, 100 ) );
+   long s1, s2;
+   {
+      ListArena inner;
+      s1 = foldl( addL, 0L, l );
+   }
+   {
+      ListArena inner;
+      List<int> other = map( inc, enumFromTo( 1000, 2000 ) );
+      sink = foldl( addL, 0L, other );
+      s2 = foldl( addL, 0L, l );
+   }
+   return s1 == 5150 && s2 == 5150 && foldl( addL, 0L, l ) == 5150;
+}
+
+// List(begin,end) allocates its node before its thunk, so the node is
+// not the arena's latest allocation when it is made; it must still be
+// the arena's, and never end up on the pool's freelists
+bool arena_owns_nodes() {
+   std::vector<int> v( 100, 1 );
+   {
+      ListArena arena;
+      for( int i = 0; i < 10; ++i )
+         sink = foldl( addL, 0L, List<int>( v.begin(), v.end() ) );
+   }
+   List<int> m = held_list( 0, 1000 );
+   std::vector<List<int> > keep;
+   for( int i = 0; i < 200; ++i )
+      keep.push_back( cons( i, m ) );
+   {
+      ListArena arena;
+      sink = foldl( addL, 0L, held_list( 0, 5000 ) );
+   }
+   for( int i = 0; i < 200; ++i )
+      if( head( keep[i] ) != i )
+         return false;
+   return foldl( addL, 0L, m ) == 499500;
+}
+
+// take(n,l) of a list of unknown length may be shorter than n
+bool take_short_input() {
+   List<int> l = take( 20, filter( odd, enumFromTo( 1, 10 ) ) );
+   return known_length( l ) == UNKNOWN_LENGTH && length( l ) == 5 &&
+      length( take( 20, list_with( 1, 2, 3 ) ) ) == 3 &&
+      length( scanlStrict( addL, 0L, take( 20, list_with( 1, 2, 3 ) ) ) ) == 4;
+}
+
+// parFoldl with an operator not marked assoc() folds serially, and so
+// takes any accumulator type
+struct XAppendDigit {
+   template <class S, class X> struct Sig : public FunType<S,X,std::string> {};
+   std::string operator()( const std::string& s, int x ) const {
+      return s + char( '0' + x % 10 );
+   }
+};
+bool par_foldl_any_op() {
+   std::vector<int> v( 100 );
+   std::iota( v.begin(), v.end(), 0 );
+   Full2<XAppendDigit> app;
+   std::string want = foldl( app, std::string(), buffer_list( v ) );
+   return want.size() == 100 &&
+      parFoldl( app, std::string(), buffer_list( v ) ) == want &&
+      parFoldl( app, std::string(), toChunked( buffer_list( v ) ) ) == want;
+}
+
+struct Check {
+   const char* what;
+   bool (*ok)();
+};
+const Check checks[] = {
+   { "nested ListArenas", arenas_nest },
+   { "arena allocations out of order", arena_owns_nodes },
+   { "take of a short list of unknown length", take_short_input },
+   { "parFoldl with a non-associative operator", par_foldl_any_op },
+};
+
+#ifdef FCPP_SIMPLE_PRELUDE
+static const char* const prelude_name = "simple";
+#else
+static const char* const prelude_name = "reuser";
+#endif
+
+void run( int n, std::vector<Row>& rows ) {
+   const int half = n / 2;
+   const int chunk = 16;
+   List<int> l = held_list( 0, n );
+   List<int> a = held_list( 0, half ), b = held_list( half, n-half );
+   List<List<int> > chunks;
+   for( int i = (n/chunk - 1) * chunk; i >= 0; i -= chunk )
+      chunks = cons( held_list( i, chunk ), chunks );
+
+   std::vector<int> v( n );
+   std::iota( v.begin(), v.end(), 0 );
+   std::vector<int> va( v.begin(), v.begin()+half ), vb( v.begin()+half, v.end() );
+   std::vector<std::vector<int> > vchunks;
+   for( int i = 0; i + chunk <= n; i += chunk )
+      vchunks.push_back( std::vector<int>( v.begin()+i, v.begin()+i+chunk ) );
+   List<int> bl = buffer_list( v );
+   std::vector<double> vd( v.begin(), v.end() );
+   List<double> bd = buffer_list( vd );
+
+#define FCPP_BENCH(op, fcpp_expr, vector_body) \
+   rows.push_back( measure( op, "fcpp", n, [&]() -> long { return fcpp_expr; } ) ); \
+   rows.push_back( measure( op, "vector", n, [&]() -> long { vector_body } ) );
+
+   FCPP_BENCH( "map", consume( map( inc, l ) ),
+      std::vector<int> out( v.size() );
+      std::transform( v.begin(), v.end(), out.begin(), [](int x){ return x+1; } );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "filter", consume( filter( even, l ) ),
+      std::vector<int> out;
+      std::copy_if( v.begin(), v.end(), std::back_inserter(out),
+                    [](int x){ return x % 2 == 0; } );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "foldl", foldl( addL, 0L, l ),
+      return std::accumulate( v.begin(), v.end(), 0L ); )
+
+   FCPP_BENCH( "foldr", foldr( addL, 0L, l ),
+      return std::accumulate( v.rbegin(), v.rend(), 0L ); )
+
+   FCPP_BENCH( "cat", consume( cat( a, b ) ),
+      std::vector<int> out( va );
+      out.insert( out.end(), vb.begin(), vb.end() );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "concat", consume( concat( chunks ) ),
+      std::vector<int> out;
+      for( std::size_t i = 0; i < vchunks.size(); ++i )
+         out.insert( out.end(), vchunks[i].begin(), vchunks[i].end() );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "take", consume( take( half, l ) ),
+      std::vector<int> out( v.begin(), v.begin()+half );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "drop", consume( drop( half, l ) ),
+      std::vector<int> out( v.begin()+half, v.end() );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "zipWith", consume( zipWith( plus, l, l ) ),
+      std::vector<int> out( v.size() );
+      std::transform( v.begin(), v.end(), v.begin(), out.begin(),
+                      std::plus<int>() );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "reverse", consume( reverse( l ) ),
+      std::vector<int> out( v.rbegin(), v.rend() );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "length", length( l ),
+      return long( v.size() ); )
+
+   FCPP_BENCH( "iterator", walk_iterator( l ),
+      return consume_vec( v ); )
+
+   FCPP_BENCH( "view", walk_view( l ),
+      return consume_vec( v ); )
+
+   FCPP_BENCH( "enumFromTo", consume( enumFromTo( 0, n-1 ) ),
+      std::vector<int> out( n );
+      std::iota( out.begin(), out.end(), 0 );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "iterate", consume( take( n, iterate( inc, 0 ) ) ),
+      std::vector<int> out;
+      int x = 0;
+      for( int i = 0; i < n; ++i, ++x )
+         out.push_back( x );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "builder", consume( build_list( n ) ),
+      std::vector<int> out;
+      for( int i = 0; i < n; ++i )
+         out.push_back( i );
+      return consume_vec( out ); )
+
+   FCPP_BENCH( "scanl", consume( scanl( addL, 0L, l ) ),
+      std::vector<long> out;
+      long s = 0;
+      out.push_back( s );
+      for( std::size_t i = 0; i < v.size(); ++i )
+         out.push_back( s += v[i] );
+      return consume_vec( out ); )
+
+   // A strict consumer of a chain of producers (fused into one loop)
+   FCPP_BENCH( "pipeline",
+      foldl( addL, 0L, map( inc, filter( even, enumFromTo( 0, n-1 ) ) ) ),
+      long s = 0;
+      for( int x = 0; x < n; ++x )
+         if( x % 2 == 0 )
+            s += x+1;
+      return s; )
+
+   // Reductions of a buffer_list (by the vector kernels in simd.h)
+   FCPP_BENCH( "sum", long( sum( bd ) ),
+      return long( std::accumulate( vd.begin(), vd.end(), 0.0 ) ); )
+
+   FCPP_BENCH( "maximum", maximum( bl ),
+      return *std::max_element( v.begin(), v.end() ); )
+
+#undef FCPP_BENCH
+
+   ChunkedList<int> c = toChunked( l );
+   sink = chunkedFoldl( addL, 0L, c );   // force it, like l
+
+#define FCPP_BENCH_CHUNKED(op, expr) \
+   rows.push_back( measure( op, "chunked", n, [&]() -> long { return expr; } ) );
+
+   FCPP_BENCH_CHUNKED( "map", consume_chunked( chunkedMap( inc, c ) ) )
+   FCPP_BENCH_CHUNKED( "filter", consume_chunked( chunkedFilter( even, c ) ) )
+   FCPP_BENCH_CHUNKED( "foldl", chunkedFoldl( addL, 0L, c ) )
+   FCPP_BENCH_CHUNKED( "take", consume_chunked( chunkedTake( half, c ) ) )
+   FCPP_BENCH_CHUNKED( "zipWith",
+                       consume_chunked( chunkedZipWith( plus, c, c ) ) )
+
+#undef FCPP_BENCH_CHUNKED
+}
+
+int main( int argc, char** argv ) {
+   bool json = false;
+   std::vector<int> sizes;
+   for( int i = 1; i < argc; ++i ) {
+      if( std::strcmp( argv[i], "--json" ) == 0 )
+         json = true;
+      else if( std::atoi( argv[i] ) >= 32 )
+         sizes.push_back( std::atoi( argv[i] ) );
+      else {
+         std::fprintf( stderr, "usage: %s [--json] [length>=32 ...]\n",
+                       argv[0] );
+         return 1;
+      }
+   }
+   if( sizes.empty() ) {
+      sizes.push_back( 1000 );
+      sizes.push_back( 10000 );
+      sizes.push_back( 100000 );
+   }
+
+   for( std::size_t i = 0; i < sizeof checks / sizeof *checks; ++i )
+      if( !checks[i].ok() ) {
+         std::fprintf( stderr, "%s: failed sanity check: %s\n", argv[0],
+                       checks[i].what );
+         return 1;
+      }
+
+   std::vector<Row> rows;
+   for( std::size_t i = 0; i < sizes.size(); ++i )
+      run( sizes[i], rows );
+
+#ifdef FCPP_STATS
+   const bool have_nodes = true;
+#else
+   const bool have_nodes = false;
+#endif
+   if( json )
+      std::printf( "[\n" );
+   else
+      std::printf( "prelude,op,impl,n,ns_per_elt,allocs_per_elt,nodes_per_elt\n" );
+   for( std::size_t i = 0; i < rows.size(); ++i ) {
+      const Row& r = rows[i];
+      char nodes[32] = "";
+      if( have_nodes )
+         std::snprintf( nodes, sizeof nodes, "%.4f", r.nodes_per_elt );
+      if( json )
+         std::printf( "  {\"prelude\": \"%s\", \"op\": \"%s\", \"impl\": \"%s\", "
+                      "\"n\": %d, \"ns_per_elt\": %.3f, "
+                      "\"allocs_per_elt\": %.4f, \"nodes_per_elt\": %s}%s\n",
+                      prelude_name, r.op, r.impl, r.n, r.ns_per_elt,
+                      r.allocs_per_elt, have_nodes ? nodes : "null",
+                      i+1 < rows.size() ? "," : "" );
+      else
+         std::printf( "%s,%s,%s,%d,%.3f,%.4f,%s\n", prelude_name, r.op,
+                      r.impl, r.n, r.ns_per_elt, r.allocs_per_elt, nodes );
+   }
+   if( json )
+      std::printf( "]\n" );
+   return 0;
+}
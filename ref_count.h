@@ -11,7 +11,14 @@
 #ifndef FCPP_REF_DOT_H
 #define FCPP_REF_DOT_H
 
-#include "config.h"
+#include <utility>
+#include <cstddef>
+#include <cstdlib>
+#include "stats.h"
+
+#ifdef FCPP_THREADSAFE
+#include <atomic>
+#endif
 
 #ifndef FCPP_NO_USE_NAMESPACE
 namespace fcpp {
@@ -26,7 +33,8 @@ namespace fcpp {
 // "circular" (self-referencing) data structures.
 //
 // Ref<T> should work exactly as T*, except that instead of dynamic_cast
-// you must use ref_dynamic_cast.
+// you must use ref_dynamic_cast.  makeRef<T>(args...) is the cheap way
+// to create a T and a Ref to it.
 //////////////////////////////////////////////////////////////////////
 // IRef<T> is an intrusive reference count.  All components of the
 // library use IRefs instead of Refs now, as IRefs are more
@@ -39,8 +47,8 @@ namespace fcpp {
 //       mutable RefCountType refC_;
 //    public:
 //       Foo() : refC_(0) {}
-//       void incref() const { ++refC_; }
-//       void decref() const { if (!--refC_) delete this; }
+//       void incref() const { ref_count_inc(refC_); }
+//       void decref() const { if (ref_count_dec(refC_)) delete this; }
 //    };
 // To create a reference-counted Foo, we can just say
 //    IRef<Foo> p = new Foo;
@@ -53,7 +61,162 @@ namespace fcpp {
 // of a virtual destructor.
 //////////////////////////////////////////////////////////////////////
 
+//////////////////////////////////////////////////////////////////////
+// By default reference counts are plain unsigned ints, so FC++ values
+// (Lists, FunNs, ...) must not be shared between threads.  If the flag
+// FCPP_THREADSAFE is defined, RefCountType is an atomic instead;
+// increments are relaxed and decrements are acquire/release (the
+// decrement which reaches zero must "see" every write made through the
+// other references before it deletes the object).
+//
+// A few objects (like the List sentinels in list.h) live until the
+// program exits and are shared by everything.  They are marked with
+// ref_count_immortal(), and the atomic policy never writes to their
+// counts, so they do not become contention hot spots.
+//////////////////////////////////////////////////////////////////////
+
+#ifdef FCPP_THREADSAFE
+typedef std::atomic<unsigned int> RefCountType;
+#else
 typedef unsigned int RefCountType;
+#endif
+
+// The high bit marks an immortal count.  (In the non-threadsafe case
+// we just start the count so high it can never get back down to 0.)
+const unsigned int IMMORTAL_REF_COUNT = ~(~0u >> 1);
+
+#ifdef FCPP_THREADSAFE
+inline void ref_count_inc( RefCountType& c ) {
+   if( !(c.load(std::memory_order_relaxed) & IMMORTAL_REF_COUNT) )
+      c.fetch_add( 1, std::memory_order_relaxed );
+}
+// returns true when the count reaches 0 (that is, time to delete)
+inline bool ref_count_dec( RefCountType& c ) {
+   if( c.load(std::memory_order_relaxed) & IMMORTAL_REF_COUNT )
+      return false;
+   return c.fetch_sub( 1, std::memory_order_acq_rel ) == 1;
+}
+inline void ref_count_immortal( RefCountType& c ) {
+   c.store( IMMORTAL_REF_COUNT, std::memory_order_relaxed );
+}
+inline bool ref_count_is_immortal( const RefCountType& c ) {
+   return c.load(std::memory_order_relaxed) & IMMORTAL_REF_COUNT;
+}
+// true when the caller holds the only reference
+inline bool ref_count_is_unique( const RefCountType& c ) {
+   return c.load(std::memory_order_acquire) == 1;
+}
+#else
+inline void ref_count_inc( RefCountType& c ) { ++c; }
+inline bool ref_count_dec( RefCountType& c ) { return !--c; }
+inline void ref_count_immortal( RefCountType& c ) { c = IMMORTAL_REF_COUNT; }
+inline bool ref_count_is_immortal( const RefCountType& c ) {
+   return c & IMMORTAL_REF_COUNT;
+}
+inline bool ref_count_is_unique( const RefCountType& c ) { return c == 1; }
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// When a reference-counted object dies it drops the references it
+// holds, which may kill more objects, and so on.  Done directly (with
+// "delete this"), that is a recursion as deep as the chain: a long
+// list's nodes, a thunk holding a list whose nodes hold thunks, a cat
+// of a cat of a cat...  Deep enough, and it blows the stack.
+//
+// So the library's counted objects (list nodes, thunks and the other
+// IRefables, ByNeeds, Ref's blocks) are freed through release(p,d),
+// which calls d(p) to destroy p.  release() never nests: a call made
+// while another object is being destroyed just queues p, and the
+// outermost call destroys whatever is queued, in a loop, once it has
+// finished with its own object.  So no
+// destructor runs more than one level deep, whatever the shape of the
+// structure.  Each thread has its own queue.  The first RELEASE_INLINE
+// entries sit in the queue itself (a long list only ever needs one or
+// two); beyond that, the queue spills to the heap until it is drained.
+// This is done in every build (the flag FCPP_SAFE_LIST, which used to
+// turn on an iterative ~List(), no longer makes a difference): the
+// queue frees a long list faster than plain recursion does.
+//////////////////////////////////////////////////////////////////////
+
+namespace impl {
+struct ReleaseItem {
+   const void* p;
+   void (*destroy)( const void* );
+};
+
+const std::size_t RELEASE_INLINE = 64;
+
+// Zero-initialized (no constructor or destructor), like the pool's
+// freelists, so it may be used at any time
+struct ReleaseQueue {
+   bool busy;                 // an outermost release() is running
+   std::size_t n;             // entries queued
+   std::size_t cap;           // room in 'more'
+   ReleaseItem* more;         // the entries after the first RELEASE_INLINE
+   ReleaseItem local[ RELEASE_INLINE ];
+};
+
+inline ReleaseQueue& release_queue() {
+#ifdef FCPP_THREADSAFE
+   static thread_local ReleaseQueue q;
+#else
+   static ReleaseQueue q;
+#endif
+   return q;
+}
+
+// Queues x; false if there's no memory for it
+inline bool release_push( ReleaseQueue& q, const ReleaseItem& x ) {
+   if( q.n < RELEASE_INLINE ) {
+      q.local[ q.n++ ] = x;
+      return true;
+   }
+   std::size_t k = q.n - RELEASE_INLINE;
+   if( k == q.cap ) {
+      std::size_t c = q.cap ? 2*q.cap : RELEASE_INLINE;
+      void* m = std::realloc( q.more, c * sizeof(ReleaseItem) );
+      if( !m )
+         return false;
+      q.more = static_cast<ReleaseItem*>( m );
+      q.cap = c;
+   }
+   q.more[k] = x;
+   ++q.n;
+   return true;
+}
+
+inline ReleaseItem release_pop( ReleaseQueue& q ) {
+   --q.n;
+   return q.n < RELEASE_INLINE ? q.local[ q.n ] 
+                               : q.more[ q.n - RELEASE_INLINE ];
+}
+}
+
+inline void release( const void* p, void (*destroy)( const void* ) ) {
+   impl::ReleaseQueue& q = impl::release_queue();
+   if( q.busy ) {
+      impl::ReleaseItem x = { p, destroy };
+      if( impl::release_push( q, x ) )
+         return;
+      // Out of memory: fall back on recursion
+   }
+   else {
+      q.busy = true;
+      destroy( p );
+      while( q.n ) {
+         impl::ReleaseItem x = impl::release_pop( q );
+         x.destroy( x.p );
+      }
+      if( q.more ) {
+         std::free( q.more );
+         q.more = 0;
+         q.cap = 0;
+      }
+      q.busy = false;
+      return;
+   }
+   destroy( p );
+}
 
 // This is a helper; it will probably be in next version of the C++ standard
 template<class T, class U>
@@ -61,47 +224,116 @@ T implicit_cast( const U& x ) {
    return x;
 }
 
-// Here's the Ref class
+// Here's the Ref class.  All the Refs sharing an object point to one
+// RefBlock, which holds the count and knows how to get rid of the
+// object.  Ref(p) allocates a RefBlock next to the object p; makeRef()
+// builds the object inside its RefBlock, so there is just one
+// allocation (and one cache line to touch) per shared object.
+namespace impl {
+struct RefBlock {
+   RefCountType count;
+   void (*dispose)( RefBlock* );   // destroys the object and the block
+   explicit RefBlock( void (*d)( RefBlock* ) ) : count(1), dispose(d) {}
+   static void release_dispose( const void* p ) {
+      RefBlock* b = static_cast<RefBlock*>( const_cast<void*>( p ) );
+      b->dispose( b );
+   }
+};
+
+template <class T>
+struct RefPtrBlock : public RefBlock {
+   T* p;
+   explicit RefPtrBlock( T* pp ) : RefBlock(&destroy), p(pp) {}
+   static void destroy( RefBlock* b ) {
+      RefPtrBlock<T>* me = static_cast<RefPtrBlock<T>*>( b );
+      delete me->p;
+      delete me;
+   }
+};
+
+template <class T>
+struct RefInPlaceBlock : public RefBlock {
+   T value;
+   template <class... Args>
+   explicit RefInPlaceBlock( Args&&... args ) 
+   : RefBlock(&destroy), value( std::forward<Args>(args)... ) {}
+   static void destroy( RefBlock* b ) {
+      delete static_cast<RefInPlaceBlock<T>*>( b );
+   }
+};
+}
+
 template<class T>
 class Ref;
 
 template <class U, class T>
 Ref<U> ref_dynamic_cast( const Ref<T>& r );
 
+template <class T, class... Args>
+Ref<T> makeRef( Args&&... args );
+
 template<class T>
 class Ref {
 protected:
    T* ptr;
-   RefCountType* count;
+   impl::RefBlock* count;
    
-   void new_ref() { count = new RefCountType(1); }
-   void inc()     { ++(*count); }
-   bool dec()     { return 0 == --(*count); }
+   void new_ref() { count = new impl::RefPtrBlock<T>(ptr); }
+   void inc()     { ref_count_inc(count->count); }
+   void dec()     { 
+      if( ref_count_dec(count->count) ) 
+         release( count, &impl::RefBlock::release_dispose ); 
+   }
+
+   Ref( T* p, impl::RefBlock* c ) : ptr(p), count(c) {}
 
    template <class U> friend class Ref;
 
    template <class U, class V>
    friend Ref<U> ref_dynamic_cast( const Ref<V>& r );
 
+   template <class U, class... Args>
+   friend Ref<U> makeRef( Args&&... args );
+
 public:
    typedef T WrappedType;
 
    explicit Ref(T* p=0) : ptr(p), count(0) {
       if(ptr) new_ref();
    }
-   Ref(const Ref<T>& other) : ptr(other.ptr), count(0) {
-      if(ptr) { count = other.count; inc(); }
+   Ref(const Ref<T>& other) : ptr(other.ptr), count(other.count) {
+      if(count) inc();
+   }
+   // The "aliasing" constructor: the result points to p (typically a
+   // part of *owner) but shares owner's count, so *owner lives at least
+   // as long as the result.
+   template <class U>
+   Ref(const Ref<U>& owner, T* p) : ptr(p), count(owner.count) {
+      if(count) inc();
    }
    ~Ref() {
-      if (ptr && dec()) { delete count; delete ptr; }
+      if(count) dec();
    }
    Ref<T>& operator=(const Ref<T>& other) {
-      T* tp = other.ptr;
-      RefCountType* tc = other.count;
-      if( tp ) { ++(*tc); }
-      if (ptr && dec()) { delete count; delete ptr; }
-      ptr = tp;
-      count = tc;
+      if( other.count ) { ref_count_inc(other.count->count); }
+      if( count ) dec();
+      ptr = other.ptr;
+      count = other.count;
+      return *this;
+   }
+   // Moves just steal the pointer; no counts change
+   Ref(Ref<T>&& other) : ptr(other.ptr), count(other.count) {
+      other.ptr = 0;
+      other.count = 0;
+   }
+   Ref<T>& operator=(Ref<T>&& other) {
+      if( this != &other ) {
+         if( count ) dec();
+         ptr = other.ptr;
+         count = other.count;
+         other.ptr = 0;
+         other.count = 0;
+      }
       return *this;
    }
 
@@ -110,8 +342,14 @@ public:
 
    template <class U>
    Ref(const Ref<U>& other) 
-   : ptr(implicit_cast<T*>(other.ptr)), count(0) {
-      if(ptr) { count = other.count; inc(); }
+   : ptr(implicit_cast<T*>(other.ptr)), count(other.count) {
+      if(count) inc();
+   }
+   template <class U>
+   Ref(Ref<U>&& other) 
+   : ptr(implicit_cast<T*>(other.ptr)), count(other.count) {
+      other.ptr = 0;
+      other.count = 0;
    }
    bool operator==(const Ref<T>& other) const {
       return ptr==other.ptr;
@@ -121,6 +359,15 @@ public:
    }
 };
 
+// Builds a T from args in the same block as its count:
+//    Ref<Foo> p = makeRef<Foo>( 1, "two" );
+template <class T, class... Args>
+Ref<T> makeRef( Args&&... args ) {
+   impl::RefInPlaceBlock<T>* b = 
+      new impl::RefInPlaceBlock<T>( std::forward<Args>(args)... );
+   return Ref<T>( &b->value, b );
+}
+
 // dynamic_cast; can't overload the operator (why?!?) so we create our own
 
 template <class U, class T>
@@ -151,27 +398,40 @@ public:
 
    explicit IRef(T* p=0) : ptr(p) {
 #ifndef FCPP_LEAK
-      if(ptr) ptr->incref();
+      if(ptr) { FCPP_STAT(increfs); ptr->incref(); }
 #endif
    }
    IRef(const IRef<T>& other) : ptr(other.ptr) {
 #ifndef FCPP_LEAK
-      if(ptr) { ptr->incref(); }
+      if(ptr) { FCPP_STAT(increfs); ptr->incref(); }
 #endif
    }
    ~IRef() {
 #ifndef FCPP_LEAK
-      if (ptr) { ptr->decref(); }
+      if (ptr) { FCPP_STAT(decrefs); ptr->decref(); }
 #endif
    }
    IRef<T>& operator=(const IRef<T>& other) {
 #ifndef FCPP_LEAK
-      if (other.ptr) { other.ptr->incref(); }
-      if (ptr) { ptr->decref(); }
+      if (other.ptr) { FCPP_STAT(increfs); other.ptr->incref(); }
+      if (ptr) { FCPP_STAT(decrefs); ptr->decref(); }
 #endif
       ptr = other.ptr;
       return *this;
    }
+   // Moving an IRef leaves the source null
+   IRef(IRef<T>&& other) : ptr(other.ptr) { other.ptr = 0; }
+   IRef<T>& operator=(IRef<T>&& other) {
+      if( this != &other ) {
+         T* old = ptr;
+         ptr = other.ptr;
+         other.ptr = 0;
+#ifndef FCPP_LEAK
+         if (old) { FCPP_STAT(decrefs); old->decref(); }
+#endif
+      }
+      return *this;
+   }
    operator T* () const  { return ptr; }
    T* operator->() const { return ptr; }
    bool operator==(const IRef<T>& other) const {
@@ -187,10 +447,14 @@ public:
 struct IRefable {
    mutable RefCountType refC_;
 public:
-   IRefable(RefCountType x = 0) : refC_(x) {}
-   void incref() const { ++refC_; }
-   void decref() const { if (!--refC_) delete this; }
+   IRefable(unsigned int x = 0) : refC_(x) {}
+   void incref() const { ref_count_inc(refC_); }
+   void decref() const 
+   { if (ref_count_dec(refC_)) release( this, &release_delete ); }
    virtual ~IRefable() {}
+private:
+   static void release_delete( const void* p ) 
+   { delete static_cast<const IRefable*>( p ); }
 };
 
 #ifndef FCPP_NO_USE_NAMESPACE
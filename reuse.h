@@ -77,8 +77,14 @@ struct Reuser0 {
    Reuser0(AUniqueTypeForNil) {}
    Reuser0(const M* m) : ref(m) {}
    Fun0<R> operator()( const F& f ) {
-      if( !ref )   ref = IRef<const M>( new M(f) );
-      else         ref->init(f);
+      if( !ref ) {
+         FCPP_STAT(reuser_fresh);
+         ref = IRef<const M>( new M(f) );
+      }
+      else {
+         FCPP_STAT(reuser_hits);
+         ref->init(f);
+      }
       return Fun0<R>( 1, ref );
    }
    void iter( const F& f ) {
@@ -115,8 +121,14 @@ struct Reuser1 {
    Reuser1(AUniqueTypeForNil) {}
    Reuser1(const M* m) : ref(m) {}
    Fun0<R> operator()( const F& f, const X& x ) {
-      if( !ref )   ref = IRef<const M>( new M(f,x) );
-      else         ref->init(f,x);
+      if( !ref ) {
+         FCPP_STAT(reuser_fresh);
+         ref = IRef<const M>( new M(f,x) );
+      }
+      else {
+         FCPP_STAT(reuser_hits);
+         ref->init(f,x);
+      }
       return Fun0<R>( 1, ref );
    }
    void iter( const F& f, const X& x ) {
@@ -156,8 +168,14 @@ struct Reuser2 {
    Reuser2(AUniqueTypeForNil) {}
    Reuser2(const M* m) : ref(m) {}
    Fun0<R> operator()( const F& f, const X& x, const Y& y ) {
-      if( !ref )   ref = IRef<const M>( new M(f,x,y) );
-      else         ref->init(f,x,y);
+      if( !ref ) {
+         FCPP_STAT(reuser_fresh);
+         ref = IRef<const M>( new M(f,x,y) );
+      }
+      else {
+         FCPP_STAT(reuser_hits);
+         ref->init(f,x,y);
+      }
       return Fun0<R>( 1, ref );
    }
    void iter( const F& f, const X& x, const Y& y ) {
@@ -204,8 +222,14 @@ struct Reuser3 {
    Reuser3(AUniqueTypeForNil) {}
    Reuser3(const M* m) : ref(m) {}
    Fun0<R> operator()( const F& f, const X& x, const Y& y, const Z& z ) {
-      if( !ref )   ref = IRef<const M>( new M(f,x,y,z) );
-      else         ref->init(f,x,y,z);
+      if( !ref ) {
+         FCPP_STAT(reuser_fresh);
+         ref = IRef<const M>( new M(f,x,y,z) );
+      }
+      else {
+         FCPP_STAT(reuser_hits);
+         ref->init(f,x,y,z);
+      }
       return Fun0<R>( 1, ref );
    }
    void iter( const F& f, const X& x, const Y& y, const Z& z ) {
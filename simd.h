@@ -0,0 +1,425 @@
+//
+// Copyright (c) 2000-2003 Brian McNamara and Yannis Smaragdakis
+//
+// Permission to use, copy, modify, distribute and sell this software
+// and its documentation for any purpose is granted without fee,
+// provided that the above copyright notice and this permission notice
+// appear in all source code copies and supporting documentation. The
+// software is provided "as is" without any express or implied
+// warranty.
+
+#ifndef FCPP_SIMD_DOT_H
+#define FCPP_SIMD_DOT_H
+
+//////////////////////////////////////////////////////////////////////
+// Vector kernels for arithmetic on ints and doubles stored contiguously
+// (in a buffer_list, or in the blocks of a ChunkedList).  The prelude
+// uses them for sum, product, minimum and maximum, and for zipWith with
+// plus, minus, multiplies, min or max; chunked.h uses them in
+// chunkedFoldl and chunkedZipWith.  On x86 they use AVX2 when the
+// processor has it (checked once, at run time) and SSE2 otherwise; on
+// other machines, or with the flag FCPP_NO_SIMD, they are plain loops.
+//
+// Element-wise results (zipWith) are the same as the scalar ones.  The
+// reductions keep SIMD_LANES running results: element i goes into
+// result i%SIMD_LANES, then the running results are combined in order,
+// and finally the elements left over at the end are folded in.  For
+// ints that gives the same answer as folding left to right; for
+// doubles, sum and product may differ from a left fold in the last
+// bits, and if there are NaNs or zeros of both signs, so may minimum
+// and maximum.  The order is the same for every instruction set, so
+// a given list always gives the same double on every machine.
+//////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include "list.h"
+
+#if !defined(FCPP_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#  define FCPP_SIMD_X86
+#  include <immintrin.h>
+#  define FCPP_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace fcpp {
+
+namespace impl {
+enum { SIMD_NONE, SIMD_PLUS, SIMD_MINUS, SIMD_TIMES, SIMD_MIN, SIMD_MAX };
+
+const std::size_t SIMD_LANES = 8;
+
+// The kernel (if any) which does what Op does to two Ts
+template <class Op, class T> struct SimdOp { static const int kind = SIMD_NONE; };
+
+template <class T> struct SimdType { static const bool value = false; };
+template <> struct SimdType<int> { static const bool value = true; };
+template <> struct SimdType<double> { static const bool value = true; };
+
+template <class T> struct SimdOp<Plus,T>
+{ static const int kind = SimdType<T>::value ? SIMD_PLUS : SIMD_NONE; };
+template <class T> struct SimdOp<Minus,T>
+{ static const int kind = SimdType<T>::value ? SIMD_MINUS : SIMD_NONE; };
+template <class T> struct SimdOp<Multiplies,T>
+{ static const int kind = SimdType<T>::value ? SIMD_TIMES : SIMD_NONE; };
+template <class T> struct SimdOp<Min,T>
+{ static const int kind = SimdType<T>::value ? SIMD_MIN : SIMD_NONE; };
+template <class T> struct SimdOp<Max,T>
+{ static const int kind = SimdType<T>::value ? SIMD_MAX : SIMD_NONE; };
+
+// The same, for folds: only the associative ops can be reassociated
+template <class Op, class T> struct SimdFoldOp {
+   static const int kind = SimdOp<Op,T>::kind == SIMD_MINUS ? SIMD_NONE
+                                                          : SimdOp<Op,T>::kind;
+};
+
+template <int K> struct SimdKind {};
+
+template <class T> T simd_op( SimdKind<SIMD_PLUS>, T x, T y )
+{ return plus( x, y ); }
+template <class T> T simd_op( SimdKind<SIMD_MINUS>, T x, T y )
+{ return minus( x, y ); }
+template <class T> T simd_op( SimdKind<SIMD_TIMES>, T x, T y )
+{ return multiplies( x, y ); }
+template <class T> T simd_op( SimdKind<SIMD_MIN>, T x, T y )
+{ return min( x, y ); }
+template <class T> T simd_op( SimdKind<SIMD_MAX>, T x, T y )
+{ return max( x, y ); }
+
+// Combines the running results, then folds in the leftovers [p,e)
+template <int K, class T>
+T simd_finish( const T* lanes, const T* p, const T* e ) {
+   T r = lanes[0];
+   for( std::size_t k = 1; k < SIMD_LANES; ++k )
+      r = simd_op( SimdKind<K>(), r, lanes[k] );
+   for( ; p != e; ++p )
+      r = simd_op( SimdKind<K>(), r, *p );
+   return r;
+}
+
+template <int K, class T>
+T scalar_reduce( const T* p, std::size_t n ) {
+   T lanes[ SIMD_LANES ];
+   std::size_t i, k;
+   for( k = 0; k < SIMD_LANES; ++k )
+      lanes[k] = p[k];
+   for( i = SIMD_LANES; i + SIMD_LANES <= n; i += SIMD_LANES )
+      for( k = 0; k < SIMD_LANES; ++k )
+         lanes[k] = simd_op( SimdKind<K>(), lanes[k], p[i+k] );
+   return simd_finish<K>( lanes, p+i, p+n );
+}
+
+template <int K, class T>
+void scalar_zip( const T* a, const T* b, T* out, std::size_t n ) {
+   for( std::size_t i = 0; i < n; ++i )
+      out[i] = simd_op( SimdKind<K>(), a[i], b[i] );
+}
+
+#ifdef FCPP_SIMD_X86
+// Each instruction set has a type holding SIMD_LANES elements, and
+// load, store and op on it.  The scalar ops are max(x,y) = x<y ? y : x
+// and min(x,y) = x<y ? x : y, which is what maxpd(y,x) and minpd(x,y)
+// do, NaNs and all.
+
+// SSE2
+struct Sse2D { __m128d r[4]; };
+struct Sse2I { __m128i r[2]; };
+template <class T> struct Sse2Lanes;
+template <> struct Sse2Lanes<double> { typedef Sse2D Type; };
+template <> struct Sse2Lanes<int> { typedef Sse2I Type; };
+
+inline Sse2D sse2_load( const double* p ) {
+   Sse2D v;
+   for( int k = 0; k < 4; ++k )
+      v.r[k] = _mm_loadu_pd( p + 2*k );
+   return v;
+}
+inline void sse2_store( double* p, const Sse2D& v ) {
+   for( int k = 0; k < 4; ++k )
+      _mm_storeu_pd( p + 2*k, v.r[k] );
+}
+inline Sse2I sse2_load( const int* p ) {
+   Sse2I v;
+   for( int k = 0; k < 2; ++k )
+      v.r[k] = _mm_loadu_si128( reinterpret_cast<const __m128i*>(p + 4*k) );
+   return v;
+}
+inline void sse2_store( int* p, const Sse2I& v ) {
+   for( int k = 0; k < 2; ++k )
+      _mm_storeu_si128( reinterpret_cast<__m128i*>(p + 4*k), v.r[k] );
+}
+
+inline __m128d sse2_op( SimdKind<SIMD_PLUS>, __m128d x, __m128d y )
+{ return _mm_add_pd( x, y ); }
+inline __m128d sse2_op( SimdKind<SIMD_MINUS>, __m128d x, __m128d y )
+{ return _mm_sub_pd( x, y ); }
+inline __m128d sse2_op( SimdKind<SIMD_TIMES>, __m128d x, __m128d y )
+{ return _mm_mul_pd( x, y ); }
+inline __m128d sse2_op( SimdKind<SIMD_MIN>, __m128d x, __m128d y )
+{ return _mm_min_pd( x, y ); }
+inline __m128d sse2_op( SimdKind<SIMD_MAX>, __m128d x, __m128d y )
+{ return _mm_max_pd( y, x ); }
+
+inline __m128i sse2_op( SimdKind<SIMD_PLUS>, __m128i x, __m128i y )
+{ return _mm_add_epi32( x, y ); }
+inline __m128i sse2_op( SimdKind<SIMD_MINUS>, __m128i x, __m128i y )
+{ return _mm_sub_epi32( x, y ); }
+inline __m128i sse2_op( SimdKind<SIMD_TIMES>, __m128i x, __m128i y ) {
+   // SSE2 only multiplies lanes 0 and 2; do 1 and 3 separately
+   __m128i even = _mm_mul_epu32( x, y );
+   __m128i odd = _mm_mul_epu32( _mm_srli_si128( x, 4 ),
+                                _mm_srli_si128( y, 4 ) );
+   return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE(0,0,2,0) ),
+                              _mm_shuffle_epi32( odd, _MM_SHUFFLE(0,0,2,0) ) );
+}
+inline __m128i sse2_op( SimdKind<SIMD_MIN>, __m128i x, __m128i y ) {
+   __m128i lt = _mm_cmplt_epi32( x, y );
+   return _mm_or_si128( _mm_and_si128( lt, x ), _mm_andnot_si128( lt, y ) );
+}
+inline __m128i sse2_op( SimdKind<SIMD_MAX>, __m128i x, __m128i y ) {
+   __m128i lt = _mm_cmplt_epi32( x, y );
+   return _mm_or_si128( _mm_and_si128( lt, y ), _mm_andnot_si128( lt, x ) );
+}
+
+template <int K>
+Sse2D sse2_op( SimdKind<K> k, const Sse2D& x, const Sse2D& y ) {
+   Sse2D v;
+   for( int i = 0; i < 4; ++i )
+      v.r[i] = sse2_op( k, x.r[i], y.r[i] );
+   return v;
+}
+template <int K>
+Sse2I sse2_op( SimdKind<K> k, const Sse2I& x, const Sse2I& y ) {
+   Sse2I v;
+   for( int i = 0; i < 2; ++i )
+      v.r[i] = sse2_op( k, x.r[i], y.r[i] );
+   return v;
+}
+
+template <int K, class T>
+T sse2_reduce( const T* p, std::size_t n ) {
+   typename Sse2Lanes<T>::Type acc = sse2_load( p );
+   std::size_t i = SIMD_LANES;
+   for( ; i + SIMD_LANES <= n; i += SIMD_LANES )
+      acc = sse2_op( SimdKind<K>(), acc, sse2_load( p+i ) );
+   T lanes[ SIMD_LANES ];
+   sse2_store( lanes, acc );
+   return simd_finish<K>( lanes, p+i, p+n );
+}
+
+template <int K, class T>
+void sse2_zip( const T* a, const T* b, T* out, std::size_t n ) {
+   std::size_t i = 0;
+   for( ; i + SIMD_LANES <= n; i += SIMD_LANES )
+      sse2_store( out+i, sse2_op( SimdKind<K>(), sse2_load( a+i ),
+                                                 sse2_load( b+i ) ) );
+   scalar_zip<K>( a+i, b+i, out+i, n-i );
+}
+
+// AVX2
+struct Avx2D { __m256d r[2]; };
+struct Avx2I { __m256i r; };
+template <class T> struct Avx2Lanes;
+template <> struct Avx2Lanes<double> { typedef Avx2D Type; };
+template <> struct Avx2Lanes<int> { typedef Avx2I Type; };
+
+FCPP_AVX2 inline Avx2D avx2_load( const double* p ) {
+   Avx2D v;
+   v.r[0] = _mm256_loadu_pd( p );
+   v.r[1] = _mm256_loadu_pd( p + 4 );
+   return v;
+}
+FCPP_AVX2 inline void avx2_store( double* p, const Avx2D& v ) {
+   _mm256_storeu_pd( p, v.r[0] );
+   _mm256_storeu_pd( p + 4, v.r[1] );
+}
+FCPP_AVX2 inline Avx2I avx2_load( const int* p ) {
+   Avx2I v;
+   v.r = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(p) );
+   return v;
+}
+FCPP_AVX2 inline void avx2_store( int* p, const Avx2I& v ) {
+   _mm256_storeu_si256( reinterpret_cast<__m256i*>(p), v.r );
+}
+
+FCPP_AVX2 inline __m256d avx2_op( SimdKind<SIMD_PLUS>, __m256d x, __m256d y )
+{ return _mm256_add_pd( x, y ); }
+FCPP_AVX2 inline __m256d avx2_op( SimdKind<SIMD_MINUS>, __m256d x, __m256d y )
+{ return _mm256_sub_pd( x, y ); }
+FCPP_AVX2 inline __m256d avx2_op( SimdKind<SIMD_TIMES>, __m256d x, __m256d y )
+{ return _mm256_mul_pd( x, y ); }
+FCPP_AVX2 inline __m256d avx2_op( SimdKind<SIMD_MIN>, __m256d x, __m256d y )
+{ return _mm256_min_pd( x, y ); }
+FCPP_AVX2 inline __m256d avx2_op( SimdKind<SIMD_MAX>, __m256d x, __m256d y )
+{ return _mm256_max_pd( y, x ); }
+
+FCPP_AVX2 inline __m256i avx2_op( SimdKind<SIMD_PLUS>, __m256i x, __m256i y )
+{ return _mm256_add_epi32( x, y ); }
+FCPP_AVX2 inline __m256i avx2_op( SimdKind<SIMD_MINUS>, __m256i x, __m256i y )
+{ return _mm256_sub_epi32( x, y ); }
+FCPP_AVX2 inline __m256i avx2_op( SimdKind<SIMD_TIMES>, __m256i x, __m256i y )
+{ return _mm256_mullo_epi32( x, y ); }
+FCPP_AVX2 inline __m256i avx2_op( SimdKind<SIMD_MIN>, __m256i x, __m256i y )
+{ return _mm256_min_epi32( x, y ); }
+FCPP_AVX2 inline __m256i avx2_op( SimdKind<SIMD_MAX>, __m256i x, __m256i y )
+{ return _mm256_max_epi32( x, y ); }
+
+template <int K>
+FCPP_AVX2 Avx2D avx2_op( SimdKind<K> k, const Avx2D& x, const Avx2D& y ) {
+   Avx2D v;
+   v.r[0] = avx2_op( k, x.r[0], y.r[0] );
+   v.r[1] = avx2_op( k, x.r[1], y.r[1] );
+   return v;
+}
+template <int K>
+FCPP_AVX2 Avx2I avx2_op( SimdKind<K> k, const Avx2I& x, const Avx2I& y ) {
+   Avx2I v;
+   v.r = avx2_op( k, x.r, y.r );
+   return v;
+}
+
+template <int K, class T>
+FCPP_AVX2 T avx2_reduce( const T* p, std::size_t n ) {
+   typename Avx2Lanes<T>::Type acc = avx2_load( p );
+   std::size_t i = SIMD_LANES;
+   for( ; i + SIMD_LANES <= n; i += SIMD_LANES )
+      acc = avx2_op( SimdKind<K>(), acc, avx2_load( p+i ) );
+   T lanes[ SIMD_LANES ];
+   avx2_store( lanes, acc );
+   return simd_finish<K>( lanes, p+i, p+n );
+}
+
+template <int K, class T>
+FCPP_AVX2 void avx2_zip( const T* a, const T* b, T* out, std::size_t n ) {
+   std::size_t i = 0;
+   for( ; i + SIMD_LANES <= n; i += SIMD_LANES )
+      avx2_store( out+i, avx2_op( SimdKind<K>(), avx2_load( a+i ),
+                                                 avx2_load( b+i ) ) );
+   scalar_zip<K>( a+i, b+i, out+i, n-i );
+}
+
+inline bool simd_has_avx2() {
+   static const bool avx2 = ( __builtin_cpu_init(),
+                              __builtin_cpu_supports( "avx2" ) != 0 );
+   return avx2;
+}
+#endif
+
+// Folds the n (> 0) elements at p with kernel K (not SIMD_MINUS)
+template <int K, class T>
+T simd_reduce( const T* p, std::size_t n ) {
+   if( n < SIMD_LANES ) {
+      T r = p[0];
+      for( std::size_t i = 1; i < n; ++i )
+         r = simd_op( SimdKind<K>(), r, p[i] );
+      return r;
+   }
+#ifdef FCPP_SIMD_X86
+   if( simd_has_avx2() )
+      return avx2_reduce<K>( p, n );
+   return sse2_reduce<K>( p, n );
+#else
+   return scalar_reduce<K>( p, n );
+#endif
+}
+
+// out[i] = a[i] `op` b[i] for i in [0,n), with kernel K
+template <int K, class T>
+void simd_zip( const T* a, const T* b, T* out, std::size_t n ) {
+#ifdef FCPP_SIMD_X86
+   if( simd_has_avx2() )
+      avx2_zip<K>( a, b, out, n );
+   else
+      sse2_zip<K>( a, b, out, n );
+#else
+   scalar_zip<K>( a, b, out, n );
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// The prelude's way in: folds and zips of lists which are still in a
+// buffer_list's buffer.
+//////////////////////////////////////////////////////////////////////
+
+template <int K, class T>
+struct BufferReduce {
+   static bool go( const List<T>& l, StreamSlot<T>& r ) {
+      ListBufferSpan<T> s;
+      if( !s.find(l) || s.size() == 0 )
+         return false;
+      r.put( simd_reduce<K>( &s[0], s.size() ) );
+      return true;
+   }
+};
+template <class T>
+struct BufferReduce<SIMD_NONE,T> {
+   static bool go( const List<T>&, StreamSlot<T>& ) { return false; }
+};
+
+// If l is the unwalked part of a buffer_list which Op has a kernel
+// for, puts the fold of l by Op in r (as described above) and returns
+// true.
+template <class Op, class T>
+bool buffer_reduce( const List<T>& l, StreamSlot<T>& r ) {
+   return BufferReduce<SimdFoldOp<Op,T>::kind,T>::go( l, r );
+}
+
+// zipWith of two buffers.  The results are worked out SIMD_BLOCK at a
+// time, as the list is walked.
+const std::size_t SIMD_BLOCK = 64;
+
+template <int K, class T>
+struct ZipBufferHelp : public ListStream<T> {
+   Ref<const std::vector<T> > a, b;
+   mutable std::size_t i, j, n;        // a[i..i+n) and b[j..j+n) to go
+   mutable T out[ SIMD_BLOCK ];
+   mutable std::size_t k, m;           // out[k..m) not handed out yet
+   ZipBufferHelp( const ListBufferSpan<T>& x, const ListBufferSpan<T>& y )
+   : a(x.buf), b(y.buf), i(x.i), j(y.i),
+     n( x.size() < y.size() ? x.size() : y.size() ), k(0), m(0) {}
+   bool next( StreamSlot<T>& x ) const {
+      if( k == m ) {
+         if( n == 0 )
+            return false;
+         m = n < SIMD_BLOCK ? n : SIMD_BLOCK;
+         simd_zip<K>( &(*a)[i], &(*b)[j], out, m );
+         i += m;
+         j += m;
+         n -= m;
+         k = 0;
+      }
+      x.put( out[k++] );
+      return true;
+   }
+};
+
+template <int K, class T>
+struct BufferZip {
+   static bool go( const List<T>& a, const List<T>& b, List<T>& r ) {
+      ListBufferSpan<T> s, t;
+      if( !s.find(a) || !t.find(b) )
+         return false;
+      r = Fun0< OddList<T> >( 1, new ZipBufferHelp<K,T>( s, t ) );
+      return true;
+   }
+};
+template <class T>
+struct BufferZip<SIMD_NONE,T> {
+   static bool go( const List<T>&, const List<T>&, List<T>& )
+   { return false; }
+};
+
+// If a and b are both unwalked parts of buffer_lists, and Op has a
+// kernel for their elements, sets r to zipWith(op,a,b) and returns true.
+template <class Op, class A, class B, class R>
+bool buffer_zip( const List<A>&, const List<B>&, List<R>& ) {
+   return false;
+}
+template <class Op, class T>
+bool buffer_zip( const List<T>& a, const List<T>& b, List<T>& r ) {
+   return BufferZip<SimdOp<Op,T>::kind,T>::go( a, b, r );
+}
+} // end namespace impl
+
+} // end namespace fcpp
+
+#endif
@@ -0,0 +1,62 @@
+//
+// Copyright (c) 2000-2003 Brian McNamara and Yannis Smaragdakis
+//
+// Permission to use, copy, modify, distribute and sell this software
+// and its documentation for any purpose is granted without fee,
+// provided that the above copyright notice and this permission notice
+// appear in all source code copies and supporting documentation. The
+// software is provided "as is" without any express or implied
+// warranty.
+
+#ifndef FCPP_STATS_DOT_H
+#define FCPP_STATS_DOT_H
+
+#include "config.h"
+
+//////////////////////////////////////////////////////////////////////
+// Performance counters.  If the flag FCPP_STATS is defined, the library
+// counts (per thread) the events below, and stats() returns a snapshot
+// of the calling thread's counts:
+//    reset_stats();
+//    int x = foldl( plus, 0, map( inc, enumFromTo(1,1000) ) );
+//    Stats s = stats();
+//    std::cout << s.cache_allocs << " list nodes" << std::endl;
+// Without FCPP_STATS the counting compiles to nothing, and stats()
+// always returns zeros.
+//////////////////////////////////////////////////////////////////////
+
+namespace fcpp {
+
+struct Stats {
+   unsigned long cache_allocs;     // List nodes (Cache<T>s) created
+   unsigned long cache_forces;     // List node thunks run
+   unsigned long blackhole_hits;   // forces which found the node already
+                                   // being forced (by another thread)
+   unsigned long fun0_calls;       // calls through Fun0 (virtual dispatch)
+   unsigned long reuser_hits;      // Reuser calls which recycled a thunk
+   unsigned long reuser_fresh;     // Reuser calls which made a new thunk
+   unsigned long increfs;          // IRef reference count increments
+   unsigned long decrefs;          // IRef reference count decrements
+};
+
+#ifdef FCPP_STATS
+namespace impl {
+inline Stats& stats_counters() {
+   static thread_local Stats s;   // zero-initialized
+   return s;
+}
+}
+#  define FCPP_STAT(counter) (++::fcpp::impl::stats_counters().counter)
+
+inline Stats stats() { return impl::stats_counters(); }
+inline void reset_stats() { impl::stats_counters() = Stats(); }
+#else
+#  define FCPP_STAT(counter) ((void)0)
+
+inline Stats stats() { return Stats(); }
+inline void reset_stats() {}
+#endif
+
+} // end namespace fcpp
+
+#endif